@@ -0,0 +1,123 @@
+// per-keystroke latency of incremental parsing against full parsing
+// build with 'make bench', run with 'bench/reparse [lines]'
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "parse.hpp"
+#include "struc.hpp"
+
+// a script of about n lines, with functions, loops, conditions and here-documents
+static std::string make_script(uint32_t n)
+{
+  std::string ret = "#!/bin/sh\n";
+  for(uint32_t i=0; ret.size() == 0 || i*20 < n; i++)
+  {
+    std::string s = std::to_string(i);
+    ret += "fct_" + s + "() {\n"
+      "  local a=$1 b\n"
+      "  for b in $a x y ; do\n"
+      "    [ \"$b\" = x ] && echo \"${b}_" + s + "\" || printf '%s\\n' \"$b\"\n"
+      "  done\n"
+      "}\n"
+      "var_" + s + "=$(fct_" + s + " z | wc -l)\n"
+      "if [ \"$var_" + s + "\" -gt 1 ] ; then\n"
+      "  echo yes\n"
+      "else\n"
+      "  echo no\n"
+      "fi\n"
+      "cat << EOF\n"
+      "text $var_" + s + "\n"
+      "EOF\n"
+      "case $var_" + s + " in\n"
+      "  1) echo one ;;\n"
+      "  *) echo other ;;\n"
+      "esac\n"
+      "\n";
+  }
+  return ret;
+}
+
+static double elapsed_ms(std::chrono::steady_clock::time_point start)
+{
+  return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// same result as a full parse of the edited text
+// trees with errors are incomplete and can't be generated
+static bool check(parse_tree& tree)
+{
+  parse_tree full(tree.text());
+  bool ok = tree.errors.size() == full.errors.size() && tree.sh->lst->size() == full.sh->lst->size();
+  if(ok && full.errors.size() == 0)
+    ok = tree.sh->generate() == full.sh->generate();
+  for(uint32_t i=0; ok && i<tree.errors.size(); i++)
+    ok = tree.errors[i].i == full.errors[i].i && tree.errors[i].message == full.errors[i].message;
+  return ok;
+}
+
+// type str one char at a time at pos, then erase it one char at a time
+static bool type_and_erase(parse_tree& tree, uint64_t pos, std::string const& str, const char* name)
+{
+  std::vector<double> times;
+  uint32_t parsed=0;
+  bool ok=true;
+  for(uint32_t i=0; i<str.size(); i++)
+  {
+    auto start = std::chrono::steady_clock::now();
+    tree.edit(pos+i, pos+i, str.substr(i, 1));
+    times.push_back(elapsed_ms(start));
+    parsed += tree.parsed;
+    ok &= check(tree);
+  }
+
+  for(uint32_t i=str.size(); i>0; i--)
+  {
+    auto start = std::chrono::steady_clock::now();
+    tree.edit(pos+i-1, pos+i, "");
+    times.push_back(elapsed_ms(start));
+    parsed += tree.parsed;
+    ok &= check(tree);
+  }
+
+  double sum=0, max=0;
+  for(auto it: times)
+  {
+    sum += it;
+    if(it > max)
+      max = it;
+  }
+  printf("%-24s %8.3fms avg %8.3fms max  %6.1f commands parsed per key%s\n", name,
+    sum/times.size(), max, (double) parsed/times.size(), ok ? "" : "  MISMATCH");
+  return ok;
+}
+
+int main(int argc, char* argv[])
+{
+  uint32_t lines = argc > 1 ? atoi(argv[1]) : 20000;
+  std::string text = make_script(lines);
+  uint32_t nlines=0;
+  for(auto c: text)
+    nlines += c == '\n';
+
+  auto start = std::chrono::steady_clock::now();
+  parse_tree tree(text, "bench.sh");
+  double full = elapsed_ms(start);
+  printf("%u lines, %lu top-level commands\n", nlines, (unsigned long) tree.sh->lst->size());
+  printf("%-24s %8.3fms\n", "full parse", full);
+
+  // positions in the middle of the script
+  uint64_t mid = text.find("\nfct_", text.size()/2) + 1;
+  uint64_t body = text.find("\n  done\n", mid);
+  uint64_t heredoc = text.find("text ", mid);
+
+  bool ok=true;
+  ok &= type_and_erase(tree, mid-1, "\necho new command", "new top-level line");
+  ok &= type_and_erase(tree, body, "\n    b=$((b+1))", "in a function body");
+  ok &= type_and_erase(tree, heredoc, "more ", "in a here-document");
+  ok &= type_and_erase(tree, mid-1, "\nx='a b'", "with a quote");
+  return ok ? 0 : 1;
+}
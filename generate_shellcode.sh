@@ -21,8 +21,8 @@ to_cstr() {
 
 
 cat > "$tmpfile" << EOF
-#ifndef G_VERSION_H
-#define G_VERSION_H
+#ifndef G_SHELLCODE_H
+#define G_SHELLCODE_H
 EOF
 
 unset all_fields
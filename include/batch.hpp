@@ -0,0 +1,18 @@
+#ifndef BATCH_HPP
+#define BATCH_HPP
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <cstdint>
+
+// compile each file to outdir with fct(file, output), in up to jobs child processes at a time
+// get_state is called in the child after fct, and add_state in this process with its result:
+// the children started after that get the state through fork
+// a summary of timings is printed to stderr
+// return 0 if all succeeded, the status of the first failed file otherwise
+int run_batch(std::vector<std::string> const& files, std::string const& outdir, uint32_t jobs,
+  std::function<int(std::string const&, std::string const&)> const& fct,
+  std::function<std::string()> const& get_state, std::function<void(std::string const&)> const& add_state);
+
+#endif //BATCH_HPP
@@ -0,0 +1,53 @@
+#ifndef CACHE_HPP
+#define CACHE_HPP
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <cstdint>
+
+#include "context.hpp"
+
+// compiled output of an executed script
+// stored as the generated code headed by the hashes of the included files
+struct exec_cache {
+  std::string key;
+  // absolute path and hash of included files
+  std::vector<std::pair<std::string,std::string>> deps;
+  std::string output;
+  // false when the output can't be checked for changes, like with %resolve
+  bool cacheable=true;
+};
+
+// cache being filled by the current execution, nullptr if none
+extern exec_cache* g_exec_cache;
+
+// 128-bit hex hash, not cryptographic
+std::string hash_string(std::string const& in);
+
+// $LXSH_CACHE_DIR, or lxsh/ in the user cache dir. Empty if caching is disabled
+std::string get_cache_dir(run_context* run);
+
+// read the entry at path. False if missing, older than ttl seconds, 0 is no limit,
+// or if the entry or its directory could have been written by another user
+bool cache_read(std::string const& path, uint64_t ttl, std::string* out);
+
+// errors are ignored: a failed write only means a later miss
+// the oldest entries of the directory are removed past 64MiB
+void cache_write(std::string const& path, std::string const& data);
+
+// key from the lxsh version, options, runtime, script path and contents
+std::string exec_cache_key(std::string const& runtime, std::string const& filename, std::string const& contents, bool bash, run_context* run);
+
+// return path of the cached script for key if its includes didn't change, empty otherwise
+std::string exec_cache_lookup(std::string const& key, run_context* run);
+
+void exec_cache_store(exec_cache const& cache, run_context* run);
+
+// --resolve-cache, or resolve/ in the cache dir if requested by %resolve -c. Empty if none
+std::string get_resolve_cache_dir(bool requested, run_context* run);
+
+// seconds given to --resolve-ttl or %resolve -t
+uint64_t parse_ttl(std::string const& in);
+
+#endif //CACHE_HPP
@@ -0,0 +1,24 @@
+#ifndef COMPRESS_HPP
+#define COMPRESS_HPP
+
+#include <string>
+#include <vector>
+
+struct compress_report {
+  size_t original_size=0;
+  size_t output_size=0;
+  // time to decompress the payload on this host
+  double decompress_ms=0;
+};
+
+bool is_compress_method(std::string const& in);
+
+// run cmd with in as stdin and return its stdout
+std::string filter_process(std::vector<std::string> const& cmd, std::string const& in);
+
+// POSIX shell stub followed by the compressed script
+std::string make_self_extract(std::string const& script, std::string const& method, std::string const& shebang, compress_report* report=nullptr);
+
+void print_compress_report(compress_report const& report, std::string const& method);
+
+#endif //COMPRESS_HPP
@@ -0,0 +1,55 @@
+#ifndef CONTEXT_HPP
+#define CONTEXT_HPP
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <regex>
+
+#include <ztd/options.hpp>
+
+// a file read by %include
+struct include_dep {
+  // absolute path
+  std::string path;
+  std::string hash;
+  // added to included, false with -f
+  bool counted;
+};
+
+// options and state of one run: the command line has g_ctx, each lxsh_session its own
+// runs only share caches, so different runs can be processed concurrently
+struct run_context {
+  ztd::option_set options;
+
+  // set from options by get_opts()
+  bool cd=false;
+  bool include=true;
+  bool resolve=true;
+  bool shebang=true;
+  uint32_t jobs=0;
+  std::regex re_var_exclude;
+  std::regex re_fct_exclude;
+
+  // absolute paths of the files included so far
+  std::vector<std::string> included;
+  // every file read by %include, in order: dependencies of the generated code
+  std::vector<include_dep> include_deps;
+  // number of %resolve and %include with expanded paths that were run:
+  // their result can't be checked without running them again
+  uint32_t unchecked_resolves=0;
+
+  // directory of relative paths in %include and %resolve, the working directory if empty
+  // changed instead of the working directory, which is shared by all threads
+  std::string dir;
+
+  // outputs of --parallel-resolve, by directory and command, in order of appearance
+  std::map<std::pair<std::string,std::string>, std::deque<std::pair<std::string,int>>> prefetched_resolves;
+  // depth of nested resolve() calls
+  uint32_t resolve_depth=0;
+};
+
+extern run_context g_ctx;
+
+#endif //CONTEXT_HPP
@@ -0,0 +1,18 @@
+#ifndef DAEMON_HPP
+#define DAEMON_HPP
+
+#include <string>
+#include <functional>
+
+// run lxsh on a daemon listening on socket, with the cwd, environment and stdio of this process
+// return the exit status of the run, -1 if the daemon can't be reached
+int daemon_client(std::string const& socket, int argc, char* argv[]);
+
+// listen on socket and call fct with the arguments of each client, from users with the same uid
+// requests are run in a child process, killed if the client goes away
+// state is only kept through get_state, called in the child after fct,
+// and add_state, called in the daemon with its result
+int run_daemon(std::string const& socket, std::function<int(int, char**)> const& fct,
+  std::function<std::string()> const& get_state, std::function<void(std::string const&)> const& add_state);
+
+#endif //DAEMON_HPP
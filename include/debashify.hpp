@@ -12,11 +12,19 @@ struct debashify_params {
   // map of detected arrays
   // bool value: is associative
   std::map<std::string,bool> arrays;
+  // merge results of a subtree debashify
+  void merge(debashify_params const& in) {
+    required_fcts.insert(in.required_fcts.begin(), in.required_fcts.end());
+    for(auto it: in.arrays)
+      arrays[it.first] = arrays[it.first] || it.second;
+  }
 };
 
 bool r_debashify(_obj* o, debashify_params* params);
+bool r_debashify_get_arrays(_obj* o, debashify_params* params);
 
 std::set<std::string> debashify(_obj* o, debashify_params* params);
-std::set<std::string> debashify(shmain* sh);
+// entries of the main list are processed concurrently, up to jobs at a time
+std::set<std::string> debashify(shmain* sh, uint32_t jobs);
 
 #endif //DEBASHIFY_HPP
@@ -4,8 +4,78 @@
 #include "options.hpp"
 #include "parse.hpp"
 
+#include <set>
+#include <string>
+#include <utility>
+#include <sys/types.h>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
 
-void parse_exec(FILE* fd, parse_context ct);
+// bounded ring buffer drained into a file descriptor by a writer thread
+// put() blocks while the buffer is full
+// data is written once chunk bytes are buffered, or on flush() and close()
+class stream_writer
+{
+public:
+  stream_writer(int fd, size_t size=65536, size_t chunk=16384);
+  ~stream_writer();
+
+  // return false if the output is broken: further writes are discarded
+  bool put(std::string const& in);
+  bool put(const char* in, size_t len);
+  // write buffered data without waiting for a full chunk
+  void flush();
+  // flush remaining data, stop the writer thread and close the fd
+  void close();
+
+  bool broken() const { return is_broken; }
+private:
+  void writer();
+
+  int fd;
+  std::vector<char> buffer;
+  size_t chunk;
+  size_t head=0;
+  size_t count=0;
+  bool flushing=false;
+  bool closing=false;
+  std::atomic<bool> is_broken{false};
+
+  std::mutex mtx;
+  std::condition_variable not_empty;
+  std::condition_variable not_full;
+  std::thread thread;
+};
+
+// long-lived /bin/sh running the commands sent to it over a pipe
+// each command runs in a subshell started from the given directory
+class shell_coprocess
+{
+public:
+  shell_coprocess();
+  ~shell_coprocess();
+
+  // stdout and exit status of cmd
+  std::pair<std::string, int> run(std::string const& cmd, std::string const& dir);
+private:
+  pid_t pid=0;
+  // commands to the shell
+  int in=-1;
+  // output of the commands
+  int out=-1;
+  // ends the output of a command, followed by its status
+  std::string marker;
+};
+
+// run cmd with sh from dir, in a coprocess shared by the builds of the thread
+std::pair<std::string, int> shell_run(std::string const& cmd, std::string const& dir);
+
+std::string random_string();
+
+// lxsh functions are output before their first use, fcts holds the ones already output
+void parse_exec(stream_writer* out, parse_context ct, std::set<std::string>* fcts);
 
 int exec_process(std::string const& runtime, std::vector<std::string> const& args, parse_context ct);
 
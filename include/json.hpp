@@ -0,0 +1,51 @@
+#ifndef JSON_HPP
+#define JSON_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdint>
+#include <type_traits>
+
+// JSON values, for the language server
+class json
+{
+public:
+  enum json_type { null, boolean, number, string, array, object };
+
+  json() { type=null; }
+  json(bool in) { type=boolean; b=in; }
+  json(double in) { type=number; num=in; }
+  template<class T, typename std::enable_if<std::is_integral<T>::value && !std::is_same<T, bool>::value, int>::type = 0>
+  json(T in) { type=number; num=in; }
+  json(const char* in) { type=string; str=in; }
+  json(std::string const& in) { type=string; str=in; }
+
+  static json new_array() { json ret; ret.type=array; return ret; }
+  static json new_object() { json ret; ret.type=object; return ret; }
+
+  json_type type;
+  bool b=false;
+  double num=0;
+  std::string str;
+  std::vector<json> arr;
+  std::map<std::string, json> obj;
+
+  // object members, missing ones are null
+  json const& operator[](std::string const& key) const;
+  // turns the value into an object
+  json& operator[](std::string const& key);
+  bool has(std::string const& key) const { return type == object && obj.find(key) != obj.end(); }
+
+  // turns the value into an array
+  void push_back(json const& in);
+
+  bool is_null() const { return type == null; }
+  int64_t integer() const { return type == number ? (int64_t) num : 0; }
+
+  std::string dump() const;
+  // throws std::runtime_error on invalid JSON
+  static json parse(std::string const& in);
+};
+
+#endif //JSON_HPP
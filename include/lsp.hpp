@@ -0,0 +1,10 @@
+#ifndef LSP_HPP
+#define LSP_HPP
+
+// language server on stdin and stdout
+// diagnostics, definitions, references and rename of variables and functions,
+// over the open documents and the files they %include
+// return the exit status asked by the client
+int run_lsp();
+
+#endif //LSP_HPP
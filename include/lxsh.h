@@ -0,0 +1,40 @@
+#ifndef LXSH_H
+#define LXSH_H
+
+/* C interface of liblxsh, over lxsh_session of session.hpp
+ * different handles can be used concurrently from different threads, calls on one handle must not overlap
+ * functions returning int return 0 on success, -1 on error with the message in lxsh_error() */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct lxsh_handle lxsh_handle;
+
+lxsh_handle* lxsh_new(void);
+void lxsh_free(lxsh_handle* h);
+
+/* options as given on the command line, without the program name */
+int lxsh_set_options(lxsh_handle* h, int argc, const char* const argv[]);
+
+/* parse code and add it to the script, filename can be NULL */
+int lxsh_parse(lxsh_handle* h, const char* code, const char* filename);
+int lxsh_parse_file(lxsh_handle* h, const char* filename);
+
+/* run the passes selected by the options */
+int lxsh_process(lxsh_handle* h);
+
+/* generated code, valid until the next call on h. NULL on error */
+const char* lxsh_generate(lxsh_handle* h);
+
+/* start a new script, options are kept */
+void lxsh_clear(lxsh_handle* h);
+
+/* message of the last error */
+const char* lxsh_error(lxsh_handle* h);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LXSH_H */
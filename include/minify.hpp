@@ -15,9 +15,11 @@ bool r_replace_var(_obj* in, strmap_t* varmap);
 
 strmap_t minify_var(_obj* in, std::regex const& exclude);
 strmap_t minify_fct(_obj* in, std::regex const& exclude);
+void minify_strings(shmain* sh, std::regex const& exclude);
 
 void delete_unused(_obj* in, std::regex const& var_exclude, std::regex const& fct_exclude);
 
-void minify_generic(_obj* in);
+// string processors use the options of run
+void minify_generic(_obj* in, run_context* run);
 
 #endif //MINIFY_HPP
@@ -0,0 +1,37 @@
+#ifndef OPTIMIZE_HPP
+#define OPTIMIZE_HPP
+
+#include "struc.hpp"
+#include "processing.hpp"
+
+#include <set>
+
+struct optimize_params {
+  // functions defined in the script
+  countmap_t fcts;
+  // --cat-redirect
+  bool cat_redirect=false;
+  // args whose substitutions give the exit status of their command
+  std::set<arg_t*> status_args;
+  // number of static forks removed
+  uint32_t subshell_to_brace=0;
+  uint32_t cmdsubst=0;
+  uint32_t pipeline=0;
+  // function calls replaced with their body
+  uint32_t inline_fct=0;
+  // arithmetic operations removed
+  uint32_t arithmetic=0;
+};
+
+arithmetic_t* fold_arithmetic(arithmetic_t* in, uint32_t* count);
+
+void inline_functions(shmain* sh, optimize_params* params);
+
+bool r_fold_arithmetic(_obj* in, uint32_t* count);
+bool r_subshell_to_brace(_obj* in, optimize_params* params);
+bool r_optimize_cmdsubst(_obj* in, optimize_params* params);
+bool r_optimize_pipeline(_obj* in, optimize_params* params);
+
+void optimize(_obj* in, run_context* run);
+
+#endif //OPTIMIZE_HPP
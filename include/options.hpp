@@ -3,17 +3,32 @@
 
 #include <ztd/options.hpp>
 
-extern ztd::option_set options;
+#include <stdexcept>
 
-extern bool opt_minify;
-extern bool g_cd;
-extern bool g_include;
-extern bool g_resolve;
-extern bool g_shebang;
+#include "context.hpp"
+
+// options of the command line run, in g_ctx
+extern ztd::option_set& options;
+extern bool& g_cd;
+extern bool& g_include;
+extern bool& g_resolve;
+extern bool& g_shebang;
+extern uint32_t& g_jobs;
+
+// generate minified code, per thread
+extern thread_local bool opt_minify;
 
 void print_lxsh_extension_help();
 
-void get_opts();
+// invalid option values
+class option_value_error : public std::runtime_error
+{
+public:
+  option_value_error(std::string const& what) : std::runtime_error(what) {}
+};
+
+// set the values of run from its options, throws option_value_error
+void get_opts(run_context* run);
 
 ztd::option_set gen_options();
 void print_help(const char* arg0);
@@ -36,6 +51,10 @@ options:
   -C   Don't cd
   -e   escape chars. For double quotes
   -f   ignore non zero return values
+  -c   cache output
+  -t   cache TTL in seconds
+  -i   input files of the cached command
+  -E   environment variables of the cached command
 */
 ztd::option_set create_resolve_opts();
 
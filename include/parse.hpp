@@ -38,11 +38,23 @@
 
 // structs
 
+// positions of the commands of a list, for incremental parsing
+struct list_index {
+  std::vector<uint64_t> starts;
+  // no here-document is pending at the start: parsing can resume there
+  std::vector<bool> resumable;
+  // number of errors before each command
+  std::vector<uint32_t> first_error;
+  // stop before a resumable command starting at one of these positions
+  std::set<uint64_t> stop_at;
+};
+
 struct list_parse_options {
   char end_char=0;
   bool word_mode=false;
   std::vector<std::string> end_words={};
   const char* expecting=NULL;
+  list_index* index=nullptr;
 };
 
 // globals
@@ -52,10 +64,48 @@ extern const std::set<std::string> bash_cmdvar;
 
 std::string import_file(std::string const& path);
 
-std::pair<shmain*, parse_context> parse_text(parse_context context);
+// errors throw unless they are collected in context.errors
+std::pair<shmain*, parse_context> parse_text(parse_context context, list_index* index=nullptr);
 std::pair<shmain*, parse_context> parse_text(std::string const& in, std::string const& filename="");
 inline std::pair<shmain*, parse_context> parse(std::string const& file) { return parse_text(import_file(file), file); }
 
+// a parsed text that can be edited without parsing it all again, for editors
+// errors are collected instead of printed
+class parse_tree
+{
+public:
+  parse_tree(std::string const& text, std::string const& filename="", bool bash=false);
+  ~parse_tree() { delete sh; }
+  parse_tree(parse_tree const&) = delete;
+  parse_tree& operator=(parse_tree const&) = delete;
+
+  // replace the text in [start, end) with str
+  // only the top-level commands from the edit to the first unchanged one are parsed again
+  void edit(uint64_t start, uint64_t end, std::string const& str);
+
+  std::string const& text() const { return txt; }
+
+  shmain* sh=nullptr;
+  std::vector<parse_diagnostic> errors;
+  // the last parse replaced top-level commands [first, first+removed) with [first, first+parsed)
+  uint32_t first=0;
+  uint32_t removed=0;
+  uint32_t parsed=0;
+
+  // position in the text of each top-level command
+  // positions stored in the commands are only valid for the ones of the last parse
+  std::vector<uint64_t> const& starts() const { return index.starts; }
+
+private:
+  void parse_all();
+
+  std::string txt;
+  std::string filename;
+  bool bash;
+  bool parsed_bash=false;
+  list_index index;
+};
+
 // tools
 
 parse_context make_context(std::string const& in, std::string const& filename="", bool bash=false);
@@ -71,6 +121,7 @@ void parse_error(std::string const& message, parse_context& ctx, uint64_t i);
 // ** unit parsers ** //
 
 /* util parsers */
+bool valid_name(std::string const& str);
 uint32_t word_eq(const char* word, const char* in, uint32_t size, uint32_t start, const char* end_set=NULL);
 inline bool word_eq(const char* word, parse_context const& ct, const char* end_set=NULL) {
   return word_eq(word, ct.data, ct.size, ct.i, end_set);
@@ -7,6 +7,7 @@
 #include <map>
 
 #include "struc.hpp"
+#include "context.hpp"
 
 // constants
 #define RESERVED_VARIABLES "HOME", "PATH", "SHELL", "PWD", "OPTIND", "OPTARG", "LC_.*", "LANG", "TERM", "RANDOM", "TMPDIR", "IFS"
@@ -17,17 +18,15 @@ typedef std::map<std::string,std::string> strmap_t;
 typedef std::set<std::string> set_t;
 
 // regexes
-extern std::regex re_var_exclude;
-extern std::regex re_fct_exclude;
 extern const std::regex regex_null;
 
-// Object maps (optimizations)
-extern countmap_t m_vars, m_vardefs, m_varcalls;
-extern countmap_t m_fcts, m_cmds;
-extern set_t m_excluded_var, m_excluded_fct, m_excluded_cmd;
+// Object maps (optimizations), per thread: runs on different threads don't share them
+extern thread_local countmap_t m_vars, m_vardefs, m_varcalls;
+extern thread_local countmap_t m_fcts, m_cmds;
+extern thread_local set_t m_excluded_var, m_excluded_fct, m_excluded_cmd;
 
 
-extern bool b_gotvar, b_gotfct, b_gotcmd;
+extern thread_local bool b_gotvar, b_gotfct, b_gotcmd;
 
 // tools
 countmap_t combine_maps(countmap_t const& a, countmap_t const& b);
@@ -71,7 +70,7 @@ void list_fcts(_obj* in, std::regex const& exclude);
 void list_cmds(_obj* in, std::regex const& exclude);
 
 // recursives
-bool r_has_env_set(_obj* in, bool* result);
+bool r_has_env_set(_obj* in, bool* result, countmap_t* fcts);
 bool r_get_unsets(_obj* in, set_t* unsets);
 bool r_get_var(_obj* in, countmap_t* defmap, countmap_t* callmap);
 bool r_get_cmd(_obj* in, countmap_t* all_cmds);
@@ -81,13 +80,13 @@ bool r_get_all(_obj* in, countmap_t* defmap, countmap_t* callmap, countmap_t* al
 bool r_delete_fct(_obj* in, set_t* fcts);
 bool r_delete_var(_obj* in, set_t* vars);
 bool r_delete_varfct(_obj* in, set_t* vars, set_t* fcts);
-bool r_do_string_processor(_obj* in);
+bool r_do_string_processor(_obj* in, run_context* run);
 
 /** Processing **/
 
 std::set<std::string> find_lxsh_commands(shmain* sh);
 void add_unset_variables(shmain* sh, std::regex const& exclude);
-bool has_env_set(_obj* in);
+bool has_env_set(_obj* in, countmap_t* fcts);
 
 void string_processors(_obj* in);
 
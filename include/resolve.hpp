@@ -3,17 +3,33 @@
 
 #include "struc.hpp"
 #include "parse.hpp"
+#include "context.hpp"
 
-extern std::vector<std::string> included;
+// keep parsed included files in memory for the next runs, for the command line only: the cache isn't locked
+extern bool g_include_cache;
+
+// entries added to the include cache by this process, for load_include_cache() in another one
+std::string dump_include_cache();
+// add entries dumped by another process, stops at the first invalid one
+void load_include_cache(std::string const& in);
 
 std::vector<std::pair<std::string, std::string>> do_include_raw(condlist_t* cmd, parse_context ctx, std::string* ex_dir=nullptr);
 std::pair<std::string, std::string> do_resolve_raw(condlist_t* cmd, parse_context ctx, std::string* ex_dir=nullptr);
 
-bool add_include(std::string const& file);
+// add file to the included files of run, false if it already was
+bool add_include(std::string const& file, run_context* run);
+// absolute path of an included file, from the directory of run
+std::string include_path(std::string const& file, run_context* run);
+// directory of relative paths of run
+std::string current_dir(run_context* run);
 
+// resolve %include and %resolve with the run of ctx
 void resolve(_obj* sh, parse_context ctx);
 
-std::string _pre_cd(std::string const& filename);
-void _cd(std::string const& dir);
+std::string pwd();
+
+// the working directory isn't changed: only the directory of run
+std::string _pre_cd(std::string const& filename, run_context* run);
+void _cd(std::string const& dir, run_context* run);
 
 #endif //RESOLVE_HPP
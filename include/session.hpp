@@ -0,0 +1,51 @@
+#ifndef SESSION_HPP
+#define SESSION_HPP
+
+#include <string>
+#include <vector>
+
+#include <ztd/options.hpp>
+
+#include "struc.hpp"
+#include "processing.hpp"
+#include "context.hpp"
+
+// processing passes selected by the options of run: lxsh commands, debashify, optimize and minify
+void process_script(shmain* sh, bool shebang_is_bin, run_context* run, strmap_t* varmap, strmap_t* fctmap);
+
+// use of lxsh as a library, see liblxsh in the Makefile, and lxsh.h for C
+// each session has its own options and included files: different sessions can be used
+// concurrently from different threads, calls on one session must not overlap
+class lxsh_session
+{
+public:
+  lxsh_session();
+  ~lxsh_session();
+
+  // options as given on the command line, throws ztd::option_error or option_value_error
+  void set_options(std::vector<std::string> const& args);
+
+  // parse code and add it to the script, with %include and %resolve relative to filename
+  // throws format_error on syntax errors
+  void parse(std::string const& code, std::string const& filename="");
+  void parse_file(std::string const& filename);
+
+  // run the passes selected by the options
+  void process();
+
+  std::string generate();
+
+  // start a new script, options are kept
+  void clear();
+
+  // maps of the last minify of names
+  strmap_t const& var_map() const { return varmap; }
+  strmap_t const& fct_map() const { return fctmap; }
+
+private:
+  run_context run;
+  shmain* sh;
+  strmap_t varmap, fctmap;
+};
+
+#endif //SESSION_HPP
@@ -19,6 +19,13 @@ extern const std::map<const std::string, const lxsh_fct> lxsh_extend_fcts;
 extern const std::map<const std::string, const lxsh_fct> lxsh_array_fcts;
 extern const std::map<const std::string, const lxsh_fct> lxsh_allfcts;
 
+// add dependencies of the given functions
+std::set<std::string> lxsh_fcts_depends(std::set<std::string> fcts);
+// concatenated code of the given functions, cached per set of functions
+std::string lxsh_fcts_code(std::set<std::string> const& fcts);
+
+bool r_get_lxsh_cmds(_obj* in, std::set<std::string>* fcts);
+
 void add_lxsh_fcts(shmain* sh, std::set<std::string> fcts);
 
 #endif //SHELLCODE_HPP
@@ -74,6 +74,8 @@ class arg_t;
 class subarg_t;
 class cmd_t;
 class redirect_t;
+struct parse_diagnostic;
+struct run_context;
 
 // structs
 
@@ -90,6 +92,16 @@ struct parse_context {
   bool has_errored=false;
   redirect_t* here_document=nullptr;
   char* here_delimitor=NULL;
+  // if set, errors are added here instead of being printed
+  std::vector<parse_diagnostic>* errors=nullptr;
+  // options and state used by %include and %resolve, required by resolve()
+  run_context* run=nullptr;
+};
+
+// error of a parse at position i
+struct parse_diagnostic {
+  uint64_t i;
+  std::string message;
 };
 
 struct generate_context {
@@ -143,6 +155,8 @@ public:
 
   virtual ~_obj() {;}
   virtual std::string generate(int ind)=0;
+  // deep copy
+  virtual _obj* clone()=0;
 };
 
 // meta arithmetic type
@@ -150,6 +164,7 @@ class arithmetic_t : public _obj
 {
 public:
   virtual std::string generate(int ind)=0;
+  virtual arithmetic_t* clone()=0;
 };
 
 // meta subarg type
@@ -158,6 +173,7 @@ class subarg_t : public _obj
 public:
   virtual ~subarg_t() {;}
   virtual std::string generate(int ind)=0;
+  virtual subarg_t* clone()=0;
 
   bool quoted;
 };
@@ -197,18 +213,22 @@ public:
   inline bool equals(std::string const& in) { return this->string() == in; }
 
   std::string generate(int ind);
+
+  arg_t* clone();
 };
 
 class variable_t : public _obj
 {
 public:
-  variable_t(std::string const& in="", arg_t* i=nullptr, bool def=false, bool ismanip=false, arg_t* m=nullptr) { type=_obj::variable; varname=in; index=i; definition=def; is_manip=ismanip; precedence=false; manip=m; }
+  variable_t(std::string const& in="", arg_t* i=nullptr, bool def=false, bool ismanip=false, arg_t* m=nullptr) { type=_obj::variable; varname=in; index=i; definition=def; is_manip=ismanip; precedence=false; manip=m; pos=0; }
   ~variable_t() {
     if(index!=nullptr) delete index;
     if(manip!=nullptr) delete manip;
   }
 
   std::string varname;
+  // position of the name in the parsed text
+  uint64_t pos;
   bool definition;
   arg_t* index; // for bash specific
 
@@ -217,6 +237,8 @@ public:
   arg_t* manip;
 
   std::string generate(int ind);
+
+  variable_t* clone();
 };
 
 // arglist
@@ -244,6 +266,8 @@ public:
   inline size_t size() { return args.size(); }
 
   std::string generate(int ind);
+
+  arglist_t* clone();
 };
 
 class redirect_t : public _obj
@@ -263,6 +287,8 @@ public:
   std::string op;
   arg_t* target;
   arg_t* here_document;
+
+  redirect_t* clone();
 };
 
 // Meta block
@@ -280,6 +306,7 @@ public:
   std::string generate_redirs(int ind, std::string const& _str, generate_context* ctx);
 
   virtual std::string generate(int ind, generate_context* ctx)=0;
+  virtual block_t* clone()=0;
 };
 
 // PL
@@ -297,6 +324,8 @@ public:
 
   std::string generate(int ind, generate_context* ctx);
   std::string generate(int ind) { return this->generate(ind, nullptr); };
+
+  pipeline_t* clone();
 };
 
 // CL
@@ -326,6 +355,8 @@ public:
   void negate();
 
   std::string generate(int ind);
+
+  condlist_t* clone();
 };
 
 class list_t : public _obj
@@ -349,6 +380,8 @@ public:
 
   std::string generate(int ind, bool first_indent);
   std::string generate(int ind) { return this->generate(ind, true); }
+
+  list_t* clone();
 };
 
 // block subtypes //
@@ -356,7 +389,7 @@ public:
 class cmd_t : public block_t
 {
 public:
-  cmd_t(arglist_t* in=nullptr) { type=_obj::block_cmd; args=in; is_cmdvar=false; }
+  cmd_t(arglist_t* in=nullptr) { type=_obj::block_cmd; args=in; is_cmdvar=false; pos=0; }
   ~cmd_t() {
     if(args!=nullptr) delete args;
     for(auto it: var_assigns) {
@@ -396,9 +429,13 @@ public:
   bool has_var_assign();
 
   arglist_t* args;
+  // position of the command name in the parsed text
+  uint64_t pos;
 
   std::string generate(int ind, generate_context* ctx);
   std::string generate(int ind) { return this->generate(ind, nullptr); }
+
+  cmd_t* clone();
 };
 
 class shmain : public block_t
@@ -418,6 +455,8 @@ public:
   std::string generate(bool print_shebang=true, int ind=0);
   std::string generate(int ind, generate_context* ctx);
   std::string generate(int ind) { return this->generate(ind, nullptr); }
+
+  shmain* clone();
 };
 
 class subshell_t : public block_t
@@ -435,6 +474,8 @@ public:
 
   std::string generate(int ind, generate_context* ctx);
   std::string generate(int ind) { return this->generate(ind, nullptr); }
+
+  subshell_t* clone();
 };
 
 class brace_t : public block_t
@@ -451,21 +492,27 @@ public:
 
   std::string generate(int ind, generate_context* ctx);
   std::string generate(int ind) { return this->generate(ind, nullptr); }
+
+  brace_t* clone();
 };
 
 class function_t : public block_t
 {
 public:
-  function_t(list_t* in=nullptr) { type=_obj::block_function; lst=in; }
+  function_t(list_t* in=nullptr) { type=_obj::block_function; lst=in; pos=0; }
   ~function_t() {
     if(lst!=nullptr) delete lst;
   }
 
   std::string name;
+  // position of the name in the parsed text
+  uint64_t pos;
   list_t* lst;
 
   std::string generate(int ind, generate_context* ctx);
   std::string generate(int ind) { return this->generate(ind, nullptr); }
+
+  function_t* clone();
 };
 
 class case_t : public block_t
@@ -487,6 +534,8 @@ public:
 
   std::string generate(int ind, generate_context* ctx);
   std::string generate(int ind) { return this->generate(ind, nullptr); }
+
+  case_t* clone();
 };
 
 class if_t : public block_t
@@ -508,6 +557,8 @@ public:
 
   std::string generate(int ind, generate_context* ctx);
   std::string generate(int ind) { return this->generate(ind, nullptr); }
+
+  if_t* clone();
 };
 
 class for_t : public block_t
@@ -529,6 +580,8 @@ public:
 
   std::string generate(int ind, generate_context* ctx);
   std::string generate(int ind) { return this->generate(ind, nullptr); }
+
+  for_t* clone();
 };
 
 class while_t : public block_t
@@ -547,6 +600,8 @@ public:
 
   std::string generate(int ind, generate_context* ctx);
   std::string generate(int ind) { return this->generate(ind, nullptr); }
+
+  while_t* clone();
 };
 
 // Subarg subtypes //
@@ -560,6 +615,8 @@ public:
   std::string val;
 
   std::string generate(int ind) { return val; }
+
+  subarg_string_t* clone();
 };
 
 class subarg_variable_t : public subarg_t
@@ -573,6 +630,8 @@ public:
   variable_t* var;
 
   std::string generate(int ind) { return "$" + var->generate(ind); }
+
+  subarg_variable_t* clone();
 };
 
 class subarg_arithmetic_t : public subarg_t
@@ -586,6 +645,8 @@ public:
   arithmetic_t* arith;
 
   std::string generate(int ind);
+
+  subarg_arithmetic_t* clone();
 };
 
 class subarg_subshell_t : public subarg_t
@@ -598,6 +659,8 @@ public:
   bool backtick;
 
   std::string generate(int ind);
+
+  subarg_subshell_t* clone();
 };
 
 class subarg_procsub_t : public subarg_t
@@ -611,6 +674,8 @@ public:
   subshell_t* sbsh;
 
   std::string generate(int ind);
+
+  subarg_procsub_t* clone();
 };
 
 // Arithmetic subtypes //
@@ -628,6 +693,8 @@ public:
   bool precedence;
   arithmetic_t *val1, *val2;
   std::string generate(int ind);
+
+  arithmetic_operation_t* clone();
 };
 
 class arithmetic_subshell_t : public arithmetic_t
@@ -641,6 +708,8 @@ public:
   subshell_t* sbsh;
 
   std::string generate(int ind);
+
+  arithmetic_subshell_t* clone();
 };
 
 class arithmetic_parenthesis_t : public arithmetic_t
@@ -654,6 +723,8 @@ public:
   arithmetic_t* val;
 
   std::string generate(int ind);
+
+  arithmetic_parenthesis_t* clone();
 };
 
 class arithmetic_number_t : public arithmetic_t
@@ -664,6 +735,8 @@ public:
   std::string val;
 
   std::string generate(int ind) { return val; }
+
+  arithmetic_number_t* clone();
 };
 
 class arithmetic_variable_t : public arithmetic_t
@@ -677,6 +750,8 @@ public:
   variable_t* var;
 
   std::string generate(int ind);
+
+  arithmetic_variable_t* clone();
 };
 
 #endif //STRUC_HPP
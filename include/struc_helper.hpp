@@ -4,6 +4,8 @@
 #include "struc.hpp"
 
 // makers
+// string templates are parsed once and cached, copies are returned
+// templates must be constant strings: put variable parts in @N slots or parse them directly
 arg_t* make_arg(std::string const& in);
 
 cmd_t* make_cmd(std::vector<const char*> const& args);
@@ -19,9 +21,19 @@ list_t* make_list(std::string const& in);
 
 block_t* make_block(std::string const& in);
 
+// templates with slots: arguments or commands written @N are replaced with slots[N-1]
+// arg_t slots replace arguments, block_t slots replace commands and take their redirects
+// slot objects are moved into the result, copied if used more than once, deleted if unused
+// throws if a slot has no value
+cmd_t* make_cmd(std::string const& in, std::vector<_obj*> const& slots);
+condlist_t* make_condlist(std::string const& in, std::vector<_obj*> const& slots);
+list_t* make_list(std::string const& in, std::vector<_obj*> const& slots);
+block_t* make_block(std::string const& in, std::vector<_obj*> const& slots);
+
 // copy
-arg_t* copy(arg_t* in);
-variable_t* copy(variable_t* in);
+// deep copy of any object, nullptr safe
+template<class T>
+T* copy(T* in) { return in == nullptr ? nullptr : in->clone(); }
 
 // testers
 bool arg_has_char(char c, arg_t* in);
@@ -32,6 +44,9 @@ bool possibly_expands(arglist_t* in);
 void force_quotes(arg_t* in);
 void add_quotes(arg_t* in);
 
+// "$name"
+arg_t* make_quoted_var(std::string const& name);
+
 cmd_t* make_printf(arg_t* in);
 inline cmd_t* make_printf_variable(std::string const& name) {
   return make_printf(new arg_t(new subarg_variable_t(new variable_t(name))));
@@ -29,6 +29,9 @@ std::vector<std::string> split(std::string const& in, char c);
 
 std::string escape_str(std::string const& in);
 
+// shell single quoted string
+std::string single_quote(std::string const& in);
+
 inline bool is_num(char c) { return (c >= '0' && c <= '9'); }
 inline bool is_alpha(char c) { return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'); }
 inline bool is_alphanum(char c) { return is_alpha(c) || is_num(c); }
@@ -165,4 +168,11 @@ std::string escape_chars(std::string subject, const char* chars);
 
 void printFormatError(format_error const& e, bool print_line=true);
 
+// write len bytes to fd, retrying on EINTR. False on error
+bool write_all(int fd, const char* data, size_t len);
+
+// run fct(i) for i in [0,n) on up to 'jobs' threads, 0 means one per core
+// rethrows the first exception thrown by a job once all threads are done
+void parallel_for(uint32_t n, std::function<void(uint32_t)> const& fct, uint32_t jobs=0);
+
 #endif //UTIL_HPP
@@ -0,0 +1,12 @@
+#ifndef WATCH_HPP
+#define WATCH_HPP
+
+#include <string>
+#include <vector>
+#include <functional>
+
+// run build, then run it again each time one of the files given by get_files after the build changes
+// never returns unless inotify fails
+int run_watch(std::function<int()> const& build, std::function<std::vector<std::string>()> const& get_files);
+
+#endif //WATCH_HPP
@@ -100,6 +100,7 @@ for I in $( echo test/*.sh $exec_exclude | tr -s ' \n' '\n' | sort | uniq -u )
 do
   exec_test sh "$I" || err=$((err+1))
   _LXSH_OPT=-M exec_test sh "$I" " (minify)" || err=$((err+1))
+  _LXSH_OPT=-O exec_test sh "$I" " (optimize)" || err=$((err+1))
 done
 
 echo "== Size =="
@@ -112,15 +113,18 @@ echo "== Resolve =="
 
 for I in $resolve
 do
-  printf "%s: " "$I"
-  if errmsg=$($bin "$I" | sh 2>&1 >/dev/null) && [ -z "$errmsg" ]
-  then echo "Ok"
-  else
-    echo_red "Error"
-    echo ">> stderr
+  for opt in "" --parallel-resolve
+  do
+    printf "%s%s: " "$I" "${opt:+ ($opt)}"
+    if errmsg=$($bin $opt "$I" | sh 2>&1 >/dev/null) && [ -z "$errmsg" ]
+    then echo "Ok"
+    else
+      echo_red "Error"
+      echo ">> stderr
 $errmsg"
-    err=$((err+1))
-  fi
+      err=$((err+1))
+    fi
+  done
 done
 
 varlist="
@@ -169,6 +173,248 @@ varlist_used="
 4 somevar
 "
 
+echo "== Optimize =="
+_LXSH_OPT="-O -m" exec_test sh test/optimize.sh " (minify)" || err=$((err+1))
+_LXSH_OPT="-O --inline-fct --cat-redirect" exec_test sh test/optimize.sh " (inline)" || err=$((err+1))
+tmpfile=$(mktemp)
+printf 'basename() { echo mine ; }\necho "$(basename a/b)"\nB=$(basename "$tmpfile") ; echo "$B"\n' > "$tmpfile"
+printf 'wc() { echo mine ; }\necho a | wc -l\ngrep x /dev/null | wc -l\n' >> "$tmpfile"
+_LXSH_OPT="-O" exec_test sh "$tmpfile" " (redefined commands)" || err=$((err+1))
+rm -f "$tmpfile"
+
+echo "== Compress =="
+tmpfile=$(mktemp)
+for I in gzip xz zstd
+do
+  command -v $I >/dev/null || continue
+  printf "%s (%s): " test/local.sh "$I"
+  if $bin --compress=$I test/local.sh -o "$tmpfile" && [ "$(sh test/local.sh)" = "$("$tmpfile")" ] &&
+    { sh < "$tmpfile" 2>/dev/null ; [ $? -eq 126 ] ; } &&
+    [ "$(printf '. "%s"\necho "sourced $?"\n' "$tmpfile" | sh -s 2>/dev/null)" = "sourced 126" ] &&
+    [ "$(printf '. "%s"\necho "sourced $?"\n' "$tmpfile" > "$tmpfile.sh" ; sh "$tmpfile.sh" 2>/dev/null)" = "sourced 126" ]
+  then echo "Ok"
+  else
+    echo_red "Error"
+    err=$((err+1))
+  fi
+done
+rm -f "$tmpfile" "$tmpfile.sh"
+
+echo "== Resolve cache =="
+tmpdir=$(mktemp -d)
+printf 'echo "$(%%resolve -c -i in sh -c "echo >> log ; cat in")"\n' > "$tmpdir/main.sh"
+echo 1 > "$tmpdir/in"
+printf "%s: " "$tmpdir/main.sh"
+out1=$(LXSH_CACHE_DIR=$tmpdir/cache $bin "$tmpdir/main.sh" | sh)
+out2=$(LXSH_CACHE_DIR=$tmpdir/cache $bin "$tmpdir/main.sh" | sh)
+echo 2 > "$tmpdir/in"
+out3=$(LXSH_CACHE_DIR=$tmpdir/cache $bin "$tmpdir/main.sh" | sh)
+if [ "$out1$out2$out3" = "112" ] && [ "$(wc -l < "$tmpdir/log")" -eq 2 ]
+then echo "Ok"
+else
+  echo_red "Error"
+  err=$((err+1))
+fi
+rm -rf "$tmpdir"
+
+echo "== Exec cache =="
+tmpdir=$(mktemp -d)
+printf '%%include inc.sh\nfct\n' > "$tmpdir/main.sh"
+printf 'fct() { %%include val.sh ; }\necho "$(%%resolve cat val)"\n' > "$tmpdir/inc.sh"
+printf 'echo 1\n' > "$tmpdir/val.sh"
+echo a > "$tmpdir/val"
+printf "%s: " "$tmpdir/main.sh"
+out1=$(LXSH_CACHE_DIR=$tmpdir/cache $bin -e "$tmpdir/main.sh")
+out2=$(LXSH_CACHE_DIR=$tmpdir/cache $bin -e "$tmpdir/main.sh")
+printf 'echo 2\n' > "$tmpdir/val.sh"
+echo b > "$tmpdir/val"
+out3=$(LXSH_CACHE_DIR=$tmpdir/cache $bin -e "$tmpdir/main.sh")
+printf 'fct() { %%include val.sh ; }\n' > "$tmpdir/inc.sh"
+out4=$(LXSH_CACHE_DIR=$tmpdir/cache $bin -e "$tmpdir/main.sh")
+printf 'echo 3\n' > "$tmpdir/val.sh"
+out5=$(LXSH_CACHE_DIR=$tmpdir/cache $bin -e "$tmpdir/main.sh")
+if [ "$out1$out2$out3$out4$out5" = "$(printf 'a\n1a\n1b\n223')" ] && [ -n "$(ls "$tmpdir/cache")" ]
+then echo "Ok"
+else
+  echo_red "Error"
+  err=$((err+1))
+fi
+rm -rf "$tmpdir"
+
+echo "== Batch =="
+tmpdir=$(mktemp -d)
+if $bin -M --batch --outdir "$tmpdir" test/var.sh test/local.sh 2>/dev/null
+then
+  for I in test/var.sh test/local.sh
+  do
+    printf "%s (batch): " "$I"
+    if [ "$(cat "$tmpdir/${I##*/}")" = "$($bin -M "$I")" ]
+    then echo "Ok"
+    else
+      echo_red "Error"
+      err=$((err+1))
+    fi
+  done
+else
+  echo_red "Batch failed"
+  err=$((err+1))
+fi
+printf "%s (batch): " "shared include"
+mkdir "$tmpdir/in" "$tmpdir/out"
+printf 'lib() { echo "lib $1" ; }\n' > "$tmpdir/in/lib.sh"
+printf '%%include lib.sh\nlib a\n' > "$tmpdir/in/a.sh"
+printf '%%include lib.sh lib.sh\nlib b\n' > "$tmpdir/in/b.sh"
+if $bin -m -j1 --batch --outdir "$tmpdir/out" "$tmpdir/in/a.sh" "$tmpdir/in/b.sh" 2>/dev/null \
+  && [ "$(cat "$tmpdir/out/a.sh")" = "$($bin -m "$tmpdir/in/a.sh")" ] \
+  && [ "$(cat "$tmpdir/out/b.sh")" = "$($bin -m "$tmpdir/in/b.sh")" ] \
+  && [ "$(sh "$tmpdir/out/b.sh")" = "lib b" ]
+then echo "Ok"
+else
+  echo_red "Error"
+  err=$((err+1))
+fi
+rm -rf "$tmpdir"
+
+echo "== Daemon =="
+tmpdir=$(mktemp -d)
+$bin --daemon "$tmpdir/sock" &
+daemon_pid=$!
+for i in $(seq 50) ; do [ -S "$tmpdir/sock" ] && break ; sleep 0.1 ; done
+for I in test/var.sh test/local.sh
+do
+  printf "%s (daemon): " "$I"
+  if [ "$(LXSH_SOCKET=$tmpdir/sock $bin -M "$I")" = "$($bin -M "$I")" ]
+  then echo "Ok"
+  else
+    echo_red "Error"
+    err=$((err+1))
+  fi
+done
+printf "%s (daemon): " "exit status"
+if LXSH_SOCKET=$tmpdir/sock $bin "$tmpdir/nonexistent" 2>/dev/null
+then
+  echo_red "Error"
+  err=$((err+1))
+else echo "Ok"
+fi
+printf "%s (daemon): " "include cache"
+printf '%%include inc.sh\n' > "$tmpdir/main.sh"
+echo 'echo 1' > "$tmpdir/inc.sh"
+out1=$(LXSH_SOCKET=$tmpdir/sock $bin "$tmpdir/main.sh")
+out2=$(LXSH_SOCKET=$tmpdir/sock $bin "$tmpdir/main.sh")
+echo 'echo 2' > "$tmpdir/inc.sh"
+out3=$(LXSH_SOCKET=$tmpdir/sock $bin "$tmpdir/main.sh")
+if [ "$out1 $out2 $out3" = "echo 1 echo 1 echo 2" ]
+then echo "Ok"
+else
+  echo_red "Error"
+  err=$((err+1))
+fi
+cat > "$tmpdir/inc.bash" << 'EOF'
+arr=(a "b c" d)
+declare -A map
+map[key]=val
+f() {
+  [[ ${arr[1]} == b* ]] && echo "${arr[2]} ${map[key]}"
+  cat << EOF2
+here $1 ${arr[@]}
+EOF2
+  cat << 'EOF3'
+raw $x `cmd`
+EOF3
+}
+f
+EOF
+printf '%%include inc.bash\necho end\n' > "$tmpdir/main.bash"
+for opts in "--bash" "--bash -m" "--debashify" "--debashify -M"
+do
+  printf "%s (daemon): " "include cache $opts"
+  out1=$($bin $opts "$tmpdir/main.bash")
+  out2=$(LXSH_SOCKET=$tmpdir/sock $bin $opts "$tmpdir/main.bash")
+  out3=$(LXSH_SOCKET=$tmpdir/sock $bin $opts "$tmpdir/main.bash")
+  if [ "$out1" = "$out2" ] && [ "$out1" = "$out3" ] && kill -0 $daemon_pid 2>/dev/null
+  then echo "Ok"
+  else
+    echo_red "Error"
+    err=$((err+1))
+  fi
+done
+printf "%s (daemon): " "socket mode"
+case $(ls -l "$tmpdir/sock") in
+  srw-------*) echo "Ok" ;;
+  *)
+    echo_red "Error"
+    err=$((err+1))
+    ;;
+esac
+kill $daemon_pid
+wait $daemon_pid 2>/dev/null
+rm -rf "$tmpdir"
+
+echo "== Watch =="
+tmpdir=$(mktemp -d)
+printf '%%include inc.sh\necho main\n' > "$tmpdir/main.sh"
+echo 'echo one' > "$tmpdir/inc.sh"
+printf 'echo lib\n%%include -f lib.sh\n' > "$tmpdir/sub.sh"
+echo 'echo a' > "$tmpdir/lib.sh"
+$bin --watch "$tmpdir/main.sh" -o "$tmpdir/out.sh" 2>/dev/null &
+watch_pid=$!
+for i in $(seq 50) ; do [ -s "$tmpdir/out.sh" ] && break ; sleep 0.1 ; done
+echo 'echo two' > "$tmpdir/inc.sh"
+printf "%s: " "rebuild on include change"
+for i in $(seq 50) ; do grep -q two "$tmpdir/out.sh" 2>/dev/null && break ; sleep 0.1 ; done
+if [ "$(sh "$tmpdir/out.sh")" = "$(printf 'two\nmain')" ]
+then echo "Ok"
+else
+  echo_red "Error"
+  err=$((err+1))
+fi
+echo '%include sub.sh' > "$tmpdir/inc.sh"
+for i in $(seq 50) ; do grep -q lib "$tmpdir/out.sh" 2>/dev/null && break ; sleep 0.1 ; done
+echo 'echo b' > "$tmpdir/lib.sh"
+printf "%s: " "rebuild on forced include change"
+for i in $(seq 50) ; do grep -q 'echo b' "$tmpdir/out.sh" 2>/dev/null && break ; sleep 0.1 ; done
+if [ "$(sh "$tmpdir/out.sh")" = "$(printf 'lib\nb\nmain')" ]
+then echo "Ok"
+else
+  echo_red "Error"
+  err=$((err+1))
+fi
+kill $watch_pid
+wait $watch_pid 2>/dev/null
+rm -rf "$tmpdir"
+
+echo "== Language server =="
+tmpdir=$(mktemp -d)
+printf 'greet() {\n  echo "hello $name"\n}\n' > "$tmpdir/lib.sh"
+lsp_msg() { printf 'Content-Length: %d\r\n\r\n%s' "${#1}" "$1"; }
+uri="file://$tmpdir/main.sh"
+lsp_out=$( {
+  lsp_msg '{"jsonrpc":"2.0","id":1,"method":"initialize","params":{}}'
+  lsp_msg '{"jsonrpc":"2.0","method":"textDocument/didOpen","params":{"textDocument":{"uri":"'"$uri"'","text":"%include lib.sh\nname=world\ngreet\necho ${name}\n"}}}'
+  lsp_msg '{"jsonrpc":"2.0","id":2,"method":"textDocument/definition","params":{"textDocument":{"uri":"'"$uri"'"},"position":{"line":2,"character":2}}}'
+  lsp_msg '{"jsonrpc":"2.0","id":3,"method":"textDocument/rename","params":{"textDocument":{"uri":"'"$uri"'"},"position":{"line":3,"character":8},"newName":"who"}}'
+  lsp_msg '{"jsonrpc":"2.0","method":"textDocument/didChange","params":{"textDocument":{"uri":"'"$uri"'"},"contentChanges":[{"range":{"start":{"line":2,"character":5},"end":{"line":2,"character":5}},"text":" ("}]}}'
+  lsp_msg "$(printf '%100000s' '' | tr ' ' '[')"
+  lsp_msg '{"jsonrpc":"2.0","id":4,"method":"shutdown"}'
+  lsp_msg '{"jsonrpc":"2.0","method":"exit"}'
+} | $bin --lsp | tr -d '\r')
+for I in '"id":2,"jsonrpc":"2.0","result":[{"range":{"end":{"character":5,"line":0},"start":{"character":0,"line":0}},"uri":"file://'"$tmpdir"'/lib.sh"}]' \
+  '"newText":"who","range":{"end":{"character":19,"line":1},"start":{"character":15,"line":1}}' \
+  '"message":"Unexpected token '"'('"'"' \
+  '"error":{"code":-32700'
+do
+  printf "%s: " "lsp ${I%%,*}"
+  case $lsp_out in
+    *"$I"*) echo "Ok" ;;
+    *)
+      echo_red "Error"
+      err=$((err+1))
+      ;;
+  esac
+done
+rm -rf "$tmpdir"
+
 echo "== Variables =="
 {
   list_test test/var.sh " (list)" "$varlist" --list-var || err=$((err+1))
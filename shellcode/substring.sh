@@ -0,0 +1,24 @@
+_lxsh_substring() {
+  _lxsh_ss=$1
+  _lxsh_so=$(($2))
+  [ "$_lxsh_so" -lt 0 ] && _lxsh_so=$((${#_lxsh_ss} + _lxsh_so))
+  [ "$_lxsh_so" -lt 0 ] || [ "$_lxsh_so" -ge ${#_lxsh_ss} ] && return
+  _lxsh_sp=
+  while [ ${#_lxsh_sp} -lt "$_lxsh_so" ] ; do
+    _lxsh_sp="$_lxsh_sp?"
+  done
+  _lxsh_ss=${_lxsh_ss#$_lxsh_sp}
+  if [ $# -gt 2 ] ; then
+    _lxsh_sl=$(($3))
+    [ "$_lxsh_sl" -lt 0 ] && _lxsh_sl=$((${#_lxsh_ss} + _lxsh_sl))
+    [ "$_lxsh_sl" -lt 0 ] && return 1
+    if [ "$_lxsh_sl" -lt ${#_lxsh_ss} ] ; then
+      _lxsh_sp=
+      while [ ${#_lxsh_sp} -lt "$_lxsh_sl" ] ; do
+        _lxsh_sp="$_lxsh_sp?"
+      done
+      _lxsh_ss=${_lxsh_ss%"${_lxsh_ss#$_lxsh_sp}"}
+    fi
+  fi
+  printf "%s" "$_lxsh_ss"
+}
@@ -0,0 +1,154 @@
+#include "batch.hpp"
+
+#include <map>
+#include <set>
+#include <chrono>
+#include <thread>
+#include <stdexcept>
+
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+
+#include "util.hpp"
+
+struct batch_job {
+  std::string file;
+  std::string output;
+  std::chrono::steady_clock::time_point start;
+  double ms=0;
+  int status=-1;
+  pid_t pid=0;
+  // result of get_state in the child
+  std::string state;
+};
+
+static double elapsed_ms(std::chrono::steady_clock::time_point start)
+{
+  return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+int run_batch(std::vector<std::string> const& files, std::string const& outdir, uint32_t jobs,
+  std::function<int(std::string const&, std::string const&)> const& fct,
+  std::function<std::string()> const& get_state, std::function<void(std::string const&)> const& add_state)
+{
+  if(files.size() == 0)
+    throw std::runtime_error("No input files");
+
+  struct stat st;
+  if(stat(outdir.c_str(), &st) != 0)
+  {
+    if(mkdir(outdir.c_str(), 0755) != 0)
+      throw std::runtime_error("Cannot create directory '"+outdir+"'");
+  }
+  else if(!S_ISDIR(st.st_mode))
+    throw std::runtime_error("'"+outdir+"' is not a directory");
+
+  std::vector<batch_job> batch(files.size());
+  std::set<std::string> outputs;
+  for(uint32_t i=0; i<files.size(); i++)
+  {
+    batch[i].file = files[i];
+    batch[i].output = outdir + '/' + basename(files[i]);
+    if(!outputs.insert(batch[i].output).second)
+      throw std::runtime_error("Several inputs are named '"+basename(files[i])+"'");
+  }
+
+  if(jobs == 0)
+    jobs = std::thread::hardware_concurrency();
+  if(jobs == 0)
+    jobs = 1;
+
+  auto start = std::chrono::steady_clock::now();
+  // state pipe of each running job
+  std::map<int, uint32_t> running;
+  uint32_t next=0;
+  while(next < batch.size() || running.size() > 0)
+  {
+    while(next < batch.size() && running.size() < jobs)
+    {
+      int statefds[2];
+      if(pipe2(statefds, O_CLOEXEC) < 0)
+        throw std::runtime_error("pipe() failed");
+      batch[next].start = std::chrono::steady_clock::now();
+      pid_t pid = fork();
+      if(pid < 0)
+        throw std::runtime_error("fork() failed");
+      if(pid == 0)
+      {
+        close(statefds[0]);
+        int status = fct(batch[next].file, batch[next].output);
+        std::string state = get_state();
+        write_all(statefds[1], state.data(), state.size());
+        exit(status);
+      }
+      close(statefds[1]);
+      batch[next].pid = pid;
+      running[statefds[0]] = next++;
+    }
+
+    // jobs started after this one get its state
+    std::vector<struct pollfd> pfds;
+    for(auto it: running)
+      pfds.push_back({ it.first, POLLIN, 0 });
+    if(poll(pfds.data(), pfds.size(), -1) < 0)
+    {
+      if(errno == EINTR)
+        continue;
+      throw std::runtime_error("poll() failed");
+    }
+    for(auto it: pfds)
+    {
+      if(it.revents == 0)
+        continue;
+      batch_job& job = batch[running[it.fd]];
+      char buf[65536];
+      ssize_t r = read(it.fd, buf, sizeof(buf));
+      if(r < 0 && errno == EINTR)
+        continue;
+      if(r > 0)
+      {
+        job.state.append(buf, r);
+        continue;
+      }
+      // the child is done
+      close(it.fd);
+      running.erase(it.fd);
+      int stat;
+      while(waitpid(job.pid, &stat, 0) < 0)
+      {
+        if(errno != EINTR)
+          throw std::runtime_error("waitpid() failed");
+      }
+      job.ms = elapsed_ms(job.start);
+      job.status = WIFEXITED(stat) ? WEXITSTATUS(stat) : 128 + WTERMSIG(stat);
+      add_state(job.state);
+      job.state.clear();
+    }
+  }
+  double total = elapsed_ms(start);
+
+  int ret=0;
+  uint32_t failed=0;
+  double sum=0;
+  for(auto& it: batch)
+  {
+    sum += it.ms;
+    if(it.status == 0)
+      fprintf(stderr, "%10.1fms  %s\n", it.ms, it.file.c_str());
+    else
+    {
+      fprintf(stderr, "%10.1fms  %s: failed with status %d\n", it.ms, it.file.c_str(), it.status);
+      if(ret == 0)
+        ret = it.status;
+      failed++;
+    }
+  }
+  fprintf(stderr, "%lu files, %u failed, %.1fms total, %.1fms with %u jobs\n",
+    (unsigned long) batch.size(), failed, sum, total, jobs);
+
+  return ret;
+}
@@ -0,0 +1,236 @@
+#include "cache.hpp"
+
+#include <fstream>
+#include <iterator>
+#include <algorithm>
+#include <ctime>
+
+#include <stdlib.h>
+#include <limits.h>
+#include <errno.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <utime.h>
+#include <sys/stat.h>
+
+#include "options.hpp"
+#include "parse.hpp"
+#include "util.hpp"
+
+#include "version.h"
+#include "g_version.h"
+
+#define CACHE_DEP_PREFIX "# lxsh-dep "
+// size of each cache directory
+#define CACHE_MAX_SIZE (64*1024*1024)
+
+exec_cache* g_exec_cache=nullptr;
+
+// two FNV-1a passes with different offsets
+std::string hash_string(std::string const& in)
+{
+  uint64_t h1=14695981039346656037ULL;
+  uint64_t h2=h1 ^ 0x9e3779b97f4a7c15ULL;
+  for(unsigned char c: in)
+  {
+    h1 = (h1 ^ c) * 1099511628211ULL;
+    h2 = (h2 ^ c) * 1099511628211ULL;
+    h2 ^= h2 >> 29;
+  }
+  return strf("%016lx%016lx", (unsigned long) h1, (unsigned long) h2);
+}
+
+std::string get_cache_dir(run_context* run)
+{
+  if(run->options["no-cache"])
+    return "";
+  const char* env = getenv("LXSH_CACHE_DIR");
+  if(env != NULL)
+    return env;
+  env = getenv("XDG_CACHE_HOME");
+  if(env != NULL && env[0] == '/')
+    return std::string(env) + "/lxsh";
+  env = getenv("HOME");
+  if(env != NULL && env[0] != 0)
+    return std::string(env) + "/.cache/lxsh";
+  return "";
+}
+
+std::string exec_cache_key(std::string const& runtime, std::string const& filename, std::string const& contents, bool bash, run_context* run)
+{
+  if(get_cache_dir(run) == "" || filename == "" || is_dev_file(filename))
+    return "";
+  char buf[PATH_MAX];
+  if(realpath(filename.c_str(), buf) == NULL)
+    return "";
+
+  std::string in = VERSION_STRING VERSION_SUFFIX;
+  in += '\0' + runtime + '\0' + buf + '\0';
+  for(auto it: { run->cd, run->include, run->resolve, bash, (bool) run->options["debashify"], (bool) run->options["no-extend"], (bool) run->options["bash"], (bool) run->options["lxsh"] })
+    in += it ? '1' : '0';
+  in += '\0' + contents;
+  return hash_string(in);
+}
+
+static std::string cache_path(std::string const& key, run_context* run)
+{
+  return get_cache_dir(run) + '/' + key + ".sh";
+}
+
+// the cache dir can be shared: only trust entries that no one else could have written
+static bool is_trusted(std::string const& path)
+{
+  struct stat st;
+  return stat(path.c_str(), &st) == 0 && st.st_uid == geteuid() && (st.st_mode & (S_IWGRP|S_IWOTH)) == 0;
+}
+
+std::string exec_cache_lookup(std::string const& key, run_context* run)
+{
+  if(key == "")
+    return "";
+  std::string path = cache_path(key, run);
+  if(!is_trusted(get_cache_dir(run)) || !is_trusted(path))
+    return "";
+  std::ifstream file(path);
+  if(!file)
+    return "";
+
+  std::string line;
+  while(std::getline(file, line) && line.substr(0, sizeof(CACHE_DEP_PREFIX)-1) == CACHE_DEP_PREFIX)
+  {
+    line = line.substr(sizeof(CACHE_DEP_PREFIX)-1);
+    size_t i = line.find(' ');
+    if(i == std::string::npos)
+      return "";
+    try
+    {
+      if(hash_string(import_file(line.substr(i+1))) != line.substr(0, i))
+        return "";
+    }
+    catch(std::runtime_error& e)
+    {
+      return "";
+    }
+  }
+  // last use, entries with the oldest are removed first
+  utime(path.c_str(), NULL);
+  return path;
+}
+
+// mkdir -p
+static bool make_dirs(std::string const& dir)
+{
+  struct stat st;
+  if(stat(dir.c_str(), &st) == 0)
+    return S_ISDIR(st.st_mode);
+  std::string parent = dirname(dir);
+  if(parent != dir && parent != "" && !make_dirs(parent))
+    return false;
+  return mkdir(dir.c_str(), 0700) == 0 || errno == EEXIST;
+}
+
+// remove the oldest entries of dir until it is under max bytes
+static void prune_cache(std::string const& dir, uint64_t max)
+{
+  DIR* d = opendir(dir.c_str());
+  if(d == NULL)
+    return;
+  std::vector<std::pair<time_t, std::pair<std::string, uint64_t>>> entries;
+  uint64_t total=0;
+  struct dirent* ent;
+  while((ent = readdir(d)) != NULL)
+  {
+    struct stat st;
+    std::string path = dir + '/' + ent->d_name;
+    if(ent->d_name[0] == '.' || stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+      continue;
+    entries.push_back(std::make_pair(st.st_mtime, std::make_pair(path, (uint64_t) st.st_size)));
+    total += st.st_size;
+  }
+  closedir(d);
+  if(total <= max)
+    return;
+  std::sort(entries.begin(), entries.end());
+  for(auto it: entries)
+  {
+    if(total <= max)
+      break;
+    if(unlink(it.second.first.c_str()) == 0)
+      total -= it.second.second;
+  }
+}
+
+bool cache_read(std::string const& path, uint64_t ttl, std::string* out)
+{
+  struct stat st;
+  if(stat(path.c_str(), &st) != 0 || !is_trusted(dirname(path)) || !is_trusted(path))
+    return false;
+  if(ttl > 0 && (uint64_t) (time(NULL) - st.st_mtime) >= ttl)
+    return false;
+  std::ifstream file(path, std::ios::binary);
+  if(!file)
+    return false;
+  out->assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+  return true;
+}
+
+void cache_write(std::string const& path, std::string const& data)
+{
+  if(!make_dirs(dirname(path)))
+    return;
+  // write then rename: concurrent runs never see a partial file
+  std::string tmppath = path + strf(".%d.tmp", getpid());
+  {
+    std::ofstream file(tmppath, std::ios::binary);
+    if(!file)
+      return;
+    file << data;
+    if(!file.flush() || chmod(tmppath.c_str(), 0600) != 0)
+    {
+      file.close();
+      unlink(tmppath.c_str());
+      return;
+    }
+  }
+  if(rename(tmppath.c_str(), path.c_str()) != 0)
+    unlink(tmppath.c_str());
+  prune_cache(dirname(path), CACHE_MAX_SIZE);
+}
+
+void exec_cache_store(exec_cache const& cache, run_context* run)
+{
+  if(cache.key == "" || !cache.cacheable)
+    return;
+  std::string data;
+  for(auto it: cache.deps)
+    data += CACHE_DEP_PREFIX + it.second + ' ' + it.first + '\n';
+  data += cache.output;
+  cache_write(cache_path(cache.key, run), data);
+}
+
+std::string get_resolve_cache_dir(bool requested, run_context* run)
+{
+  if(run->options["resolve-cache"])
+    return run->options["resolve-cache"].argument;
+  if(!requested)
+    return "";
+  std::string dir = get_cache_dir(run);
+  if(dir == "")
+    return "";
+  return dir + "/resolve";
+}
+
+uint64_t parse_ttl(std::string const& in)
+{
+  size_t i=0;
+  uint64_t ret=0;
+  try {
+    ret = std::stoull(in, &i);
+  }
+  catch(std::exception& e) {
+    i=0;
+  }
+  if(in == "" || i != in.size() || in[0] == '-')
+    throw std::runtime_error("Invalid TTL: "+in);
+  return ret;
+}
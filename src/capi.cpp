@@ -0,0 +1,109 @@
+#include "lxsh.h"
+
+#include "session.hpp"
+#include "util.hpp"
+
+struct lxsh_handle {
+  lxsh_session session;
+  std::string output;
+  std::string error;
+};
+
+// file:line:column: message
+static std::string format_error_string(format_error const& e)
+{
+  std::string data = e.data();
+  uint64_t line=1, col=1;
+  for(uint64_t i=0; i<data.size() && i<(uint64_t) e.where(); i++)
+  {
+    col++;
+    if(data[i] == '\n')
+    {
+      line++;
+      col=1;
+    }
+  }
+  return strf("%s:%lu:%lu: %s", e.origin(), (unsigned long) line, (unsigned long) col, e.what());
+}
+
+// run fct, exceptions become the error of the handle
+template <class F>
+static int handle_call(lxsh_handle* h, F const& fct)
+{
+  try
+  {
+    fct();
+    return 0;
+  }
+  catch(format_error& e)
+  {
+    h->error = format_error_string(e);
+  }
+  catch(std::exception& e)
+  {
+    h->error = e.what();
+  }
+  return -1;
+}
+
+lxsh_handle* lxsh_new(void)
+{
+  try
+  {
+    return new lxsh_handle;
+  }
+  catch(std::exception& e)
+  {
+    return NULL;
+  }
+}
+
+void lxsh_free(lxsh_handle* h)
+{
+  delete h;
+}
+
+int lxsh_set_options(lxsh_handle* h, int argc, const char* const argv[])
+{
+  return handle_call(h, [&]() {
+    h->session.set_options(std::vector<std::string>(argv, argv+argc));
+  });
+}
+
+int lxsh_parse(lxsh_handle* h, const char* code, const char* filename)
+{
+  return handle_call(h, [&]() {
+    h->session.parse(code, filename != NULL ? filename : "");
+  });
+}
+
+int lxsh_parse_file(lxsh_handle* h, const char* filename)
+{
+  return handle_call(h, [&]() {
+    h->session.parse_file(filename);
+  });
+}
+
+int lxsh_process(lxsh_handle* h)
+{
+  return handle_call(h, [&]() {
+    h->session.process();
+  });
+}
+
+const char* lxsh_generate(lxsh_handle* h)
+{
+  if(handle_call(h, [&]() { h->output = h->session.generate(); }) != 0)
+    return NULL;
+  return h->output.c_str();
+}
+
+void lxsh_clear(lxsh_handle* h)
+{
+  h->session.clear();
+}
+
+const char* lxsh_error(lxsh_handle* h)
+{
+  return h->error.c_str();
+}
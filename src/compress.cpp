@@ -0,0 +1,173 @@
+#include "compress.hpp"
+
+#include <map>
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "exec.hpp"
+#include "util.hpp"
+#include "cache.hpp"
+
+#define PIPE_READ  0
+#define PIPE_WRITE 1
+
+struct compress_method {
+  // compression command
+  std::vector<std::string> compress;
+  // decompression commands tried in order at runtime
+  std::vector<std::string> decompress;
+};
+
+const std::map<std::string, compress_method> compress_methods = {
+  { "gzip", { {"gzip", "-c", "-9", "-n"},    {"gzip -dc", "gunzip -c", "busybox gzip -dc"} } },
+  { "xz",   { {"xz", "-c", "-9"},            {"xz -dc", "unxz -c", "busybox xz -dc"} } },
+  { "zstd", { {"zstd", "-c", "-19", "-q"},   {"zstd -dcq", "unzstd -qc", "busybox zstd -dc"} } },
+};
+
+// %s: shebang line, %s: marker, %s: read of the shebang line, %s: marker,
+// %s: decompressors, %s: method, %u: payload offset
+// $0 is only read if its marker line is the one of this stub: when sourced, $0 is another script
+#define SELF_EXTRACT_STUB \
+"%s" \
+"# lxsh-compressed %s\n" \
+"_lxsh_m=\n" \
+"{ %sread -r _lxsh_m ; } 2>/dev/null < \"$0\"\n" \
+"[ \"$_lxsh_m\" = '# lxsh-compressed %s' ] || { echo \"lxsh: compressed script must be run from a file, not sourced or piped\" >&2 ; return 126 2>/dev/null ; exit 126 ; }\n" \
+"unset _lxsh_m\n" \
+"for _lxsh_d in %s ; do\n" \
+"  command -v \"${_lxsh_d%%%% *}\" >/dev/null && break\n" \
+"  _lxsh_d=\n" \
+"done\n" \
+"[ -n \"$_lxsh_d\" ] || { echo \"$0: %s decompressor not found\" >&2 ; exit 127 ; }\n" \
+"_lxsh_s=$(tail -c +%u \"$0\" | $_lxsh_d) || exit\n" \
+"unset _lxsh_d\n" \
+"eval \"unset _lxsh_s ; $_lxsh_s\"\n" \
+"exit\n"
+
+bool is_compress_method(std::string const& in)
+{
+  return compress_methods.find(in) != compress_methods.end();
+}
+
+std::string filter_process(std::vector<std::string> const& cmd, std::string const& in)
+{
+  int inpipe[2], outpipe[2];
+  if(pipe(inpipe) < 0)
+    throw std::runtime_error("pipe() failed");
+  if(pipe(outpipe) < 0)
+  {
+    close(inpipe[PIPE_READ]);
+    close(inpipe[PIPE_WRITE]);
+    throw std::runtime_error("pipe() failed");
+  }
+
+  std::vector<char*> args;
+  for(auto& it: cmd)
+    args.push_back((char*) it.c_str());
+  args.push_back(NULL);
+
+  pid_t pid = fork();
+  if(pid == -1)
+    throw std::runtime_error("fork() failed");
+  if(pid == 0)
+  {
+    dup2(inpipe[PIPE_READ], STDIN_FILENO);
+    dup2(outpipe[PIPE_WRITE], STDOUT_FILENO);
+    close(inpipe[PIPE_READ]);
+    close(inpipe[PIPE_WRITE]);
+    close(outpipe[PIPE_READ]);
+    close(outpipe[PIPE_WRITE]);
+    execvp(args[0], args.data());
+    _exit(127);
+  }
+  close(inpipe[PIPE_READ]);
+  close(outpipe[PIPE_WRITE]);
+
+  // feed the input from another thread while reading the output
+  int infd = inpipe[PIPE_WRITE];
+  std::thread feeder([infd, &in]() {
+    stream_writer writer(infd);
+    writer.put(in);
+    writer.close();
+  });
+  std::string ret;
+  char buf[65536];
+  ssize_t n;
+  while( (n = read(outpipe[PIPE_READ], buf, sizeof(buf))) != 0 )
+  {
+    if(n < 0)
+    {
+      if(errno == EINTR)
+        continue;
+      break;
+    }
+    ret.append(buf, n);
+  }
+  feeder.join();
+  close(outpipe[PIPE_READ]);
+
+  int stat;
+  while(waitpid(pid, &stat, 0) == -1 && errno == EINTR);
+  if(!WIFEXITED(stat) || WEXITSTATUS(stat) != 0)
+  {
+    if(WIFEXITED(stat) && WEXITSTATUS(stat) == 127)
+      throw std::runtime_error(cmd[0] + ": command not found");
+    throw std::runtime_error(cmd[0] + " failed");
+  }
+  return ret;
+}
+
+std::string make_self_extract(std::string const& script, std::string const& method, std::string const& shebang, compress_report* report)
+{
+  auto el = compress_methods.find(method);
+  if(el == compress_methods.end())
+    throw std::runtime_error("Unknown compression method: " + method);
+
+  std::string payload = filter_process(el->second.compress, script);
+
+  std::string decompressors;
+  for(auto it: el->second.decompress)
+    decompressors += '\'' + it + "' ";
+  decompressors.pop_back();
+  std::string shebang_line = shebang != "" ? shebang + '\n' : "";
+  std::string marker = hash_string(payload);
+  const char* skip_shebang = shebang != "" ? "read -r _lxsh_m ; " : "";
+
+  // the offset is part of the stub: iterate until its size is stable
+  std::string stub;
+  uint32_t offset = 1;
+  do {
+    offset = stub.size()+1;
+    stub = strf(SELF_EXTRACT_STUB, shebang_line.c_str(), marker.c_str(), skip_shebang, marker.c_str(),
+      decompressors.c_str(), method.c_str(), offset);
+  } while(stub.size()+1 != offset);
+
+  if(report != nullptr)
+  {
+    report->original_size = script.size();
+    report->output_size = stub.size() + payload.size();
+    std::vector<std::string> cmd = split(el->second.decompress[0], ' ');
+    auto start = std::chrono::steady_clock::now();
+    filter_process(cmd, payload);
+    auto end = std::chrono::steady_clock::now();
+    report->decompress_ms = std::chrono::duration<double, std::milli>(end - start).count();
+  }
+
+  return stub + payload;
+}
+
+void print_compress_report(compress_report const& report, std::string const& method)
+{
+  std::cerr << "Compression (" << method << "):\n";
+  std::cerr << "  script size: " << report.original_size << " bytes\n";
+  std::cerr << "  output size: " << report.output_size << " bytes";
+  if(report.original_size > 0)
+    std::cerr << strf(" (%.1f%%)", 100.0 * report.output_size / report.original_size);
+  std::cerr << '\n';
+  std::cerr << strf("  decompression time: %.2f ms\n", report.decompress_ms);
+}
@@ -0,0 +1,335 @@
+#include "daemon.hpp"
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+
+#include <map>
+#include <vector>
+#include <stdexcept>
+
+#include "util.hpp"
+
+#include "errcodes.h"
+
+extern char** environ;
+
+// sent along stdin, stdout and stderr, followed by size bytes of null terminated strings:
+// cwd, arguments and environment
+struct daemon_request {
+  uint32_t nargs;
+  uint32_t nenv;
+  uint32_t size;
+};
+
+static bool read_all(int fd, char* data, size_t len)
+{
+  while(len > 0)
+  {
+    ssize_t r = read(fd, data, len);
+    if(r < 0 && errno == EINTR)
+      continue;
+    if(r <= 0)
+      return false;
+    data += r;
+    len -= r;
+  }
+  return true;
+}
+
+static bool make_address(std::string const& path, struct sockaddr_un* addr)
+{
+  memset(addr, 0, sizeof(*addr));
+  addr->sun_family = AF_UNIX;
+  if(path.size() >= sizeof(addr->sun_path))
+    return false;
+  strcpy(addr->sun_path, path.c_str());
+  return true;
+}
+
+static int connect_socket(std::string const& path)
+{
+  struct sockaddr_un addr;
+  if(!make_address(path, &addr))
+    return -1;
+  int fd = socket(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0);
+  if(fd < 0)
+    return -1;
+  if(connect(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0)
+  {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+int daemon_client(std::string const& socket, int argc, char* argv[])
+{
+  char cwd[4096];
+  if(getcwd(cwd, sizeof(cwd)) == NULL)
+    return -1;
+
+  std::string data = std::string(cwd) + '\0';
+  for(int i=0; i<argc; i++)
+    data += std::string(argv[i]) + '\0';
+  uint32_t nenv=0;
+  for(char** it=environ; *it != NULL; it++, nenv++)
+    data += std::string(*it) + '\0';
+
+  int fd = connect_socket(socket);
+  if(fd < 0)
+    return -1;
+
+  daemon_request req = { (uint32_t) argc, nenv, (uint32_t) data.size() };
+  struct iovec iov = { &req, sizeof(req) };
+  int fds[3] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+  char cbuf[CMSG_SPACE(sizeof(fds))];
+  memset(cbuf, 0, sizeof(cbuf));
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = cbuf;
+  msg.msg_controllen = sizeof(cbuf);
+  struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+  memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+  // nothing was run yet: fall back to a local run
+  if(sendmsg(fd, &msg, MSG_NOSIGNAL) != sizeof(req) || !write_all(fd, data.data(), data.size()))
+  {
+    close(fd);
+    return -1;
+  }
+
+  int32_t status;
+  bool ok = read_all(fd, (char*) &status, sizeof(status));
+  close(fd);
+  if(!ok)
+  {
+    fprintf(stderr, "lxsh: lost connection to daemon on %s\n", socket.c_str());
+    return ERR_RUNTIME;
+  }
+  return status;
+}
+
+// written to by SIGCHLD: poll() wakes up when the worker exits
+static int sigchld_pipe[2] = {-1, -1};
+
+static void on_sigchld(int)
+{
+  int err=errno;
+  if(write(sigchld_pipe[1], "", 1) < 0) {}
+  errno=err;
+}
+
+// child of the daemon: read the request, run it in a worker and report its status
+// the worker and its processes are killed if the client goes away
+// statefd gets the result of get_state in the worker
+static int serve_request(int conn, int statefd, std::function<int(int, char**)> const& fct, std::function<std::string()> const& get_state)
+{
+  daemon_request req;
+  int fds[3];
+  char cbuf[CMSG_SPACE(sizeof(fds))];
+  struct iovec iov = { &req, sizeof(req) };
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = cbuf;
+  msg.msg_controllen = sizeof(cbuf);
+
+  ssize_t r;
+  while((r = recvmsg(conn, &msg, MSG_WAITALL|MSG_CMSG_CLOEXEC)) < 0 && errno == EINTR);
+  struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+  if(r != sizeof(req) || cmsg == NULL || cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(sizeof(fds)))
+    return 1;
+  memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+  std::vector<char> data(req.size);
+  if(!read_all(conn, data.data(), data.size()) || data.size() == 0 || data.back() != '\0')
+    return 1;
+  std::vector<char*> strs;
+  for(size_t i=0; i<data.size(); i += strlen(data.data()+i)+1)
+    strs.push_back(data.data()+i);
+  if(strs.size() != 1 + req.nargs + req.nenv || req.nargs < 1)
+    return 1;
+
+  if(pipe2(sigchld_pipe, O_CLOEXEC|O_NONBLOCK) < 0)
+    return 1;
+  signal(SIGCHLD, on_sigchld);
+
+  pid_t pid = fork();
+  if(pid < 0)
+    return 1;
+  if(pid == 0) // worker
+  {
+    signal(SIGCHLD, SIG_DFL);
+    setpgid(0, 0);
+    close(conn);
+    for(int i=0; i<3; i++)
+      dup2(fds[i], i);
+    for(int i=0; i<3; i++)
+      if(fds[i] > 2)
+        close(fds[i]);
+    if(chdir(strs[0]) != 0)
+    {
+      fprintf(stderr, "Cannot cd to '%s'\n", strs[0]);
+      _exit(ERR_RUNTIME);
+    }
+    std::vector<char*> args(strs.begin()+1, strs.begin()+1+req.nargs);
+    args.push_back(NULL);
+    std::vector<char*> env(strs.begin()+1+req.nargs, strs.end());
+    env.push_back(NULL);
+    environ = env.data();
+    int status = fct(req.nargs, args.data());
+    std::string state = get_state();
+    write_all(statefd, state.data(), state.size());
+    // exit() flushes the output
+    exit(status);
+  }
+  setpgid(pid, pid);
+  close(statefd);
+
+  for(int i=0; i<3; i++)
+    close(fds[i]);
+
+  // the client sends nothing more: conn is readable once it hung up
+  struct pollfd pfds[2] = { { conn, POLLIN, 0 }, { sigchld_pipe[0], POLLIN, 0 } };
+  int stat;
+  while(true)
+  {
+    pid_t w = waitpid(pid, &stat, WNOHANG);
+    if(w == pid)
+      break;
+    if(w < 0 && errno != EINTR)
+      return 1;
+    if(poll(pfds, 2, -1) < 0 && errno != EINTR)
+      return 1;
+    if(pfds[0].revents != 0)
+    {
+      kill(-pid, SIGKILL);
+      while(waitpid(pid, &stat, 0) < 0 && errno == EINTR);
+      return 0;
+    }
+    char buf[64];
+    while(read(sigchld_pipe[0], buf, sizeof(buf)) > 0);
+  }
+  int32_t status = WIFEXITED(stat) ? WEXITSTATUS(stat) : 128 + WTERMSIG(stat);
+  write_all(conn, (const char*) &status, sizeof(status));
+  return 0;
+}
+
+int run_daemon(std::string const& socket_path, std::function<int(int, char**)> const& fct,
+  std::function<std::string()> const& get_state, std::function<void(std::string const&)> const& add_state)
+{
+  struct sockaddr_un addr;
+  if(!make_address(socket_path, &addr))
+    throw std::runtime_error("Socket path too long: "+socket_path);
+
+  // don't take over the socket of a running daemon
+  int fd = connect_socket(socket_path);
+  if(fd >= 0)
+  {
+    close(fd);
+    throw std::runtime_error("A daemon is already listening on "+socket_path);
+  }
+  struct stat st;
+  if(lstat(socket_path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode))
+    unlink(socket_path.c_str());
+
+  fd = socket(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0);
+  if(fd < 0)
+    throw std::runtime_error("Cannot create socket");
+  // only the user can connect
+  mode_t mask = umask(0177);
+  int ret = bind(fd, (struct sockaddr*) &addr, sizeof(addr));
+  umask(mask);
+  if(ret < 0 || listen(fd, 64) < 0)
+  {
+    close(fd);
+    throw std::runtime_error(strf("Cannot listen on %s: %s", socket_path.c_str(), strerror(errno)));
+  }
+
+  // children are reaped automatically
+  signal(SIGCHLD, SIG_IGN);
+  // listening socket, then state pipes of the running requests
+  std::vector<struct pollfd> pfds = { { fd, POLLIN, 0 } };
+  std::map<int, std::string> states;
+  while(true)
+  {
+    if(poll(pfds.data(), pfds.size(), -1) < 0)
+    {
+      if(errno == EINTR)
+        continue;
+      close(fd);
+      throw std::runtime_error(strf("poll() failed: %s", strerror(errno)));
+    }
+
+    for(size_t i=1; i<pfds.size(); i++)
+    {
+      if(pfds[i].revents == 0)
+        continue;
+      char buf[65536];
+      ssize_t r = read(pfds[i].fd, buf, sizeof(buf));
+      if(r < 0 && errno == EINTR)
+        continue;
+      if(r > 0)
+      {
+        states[pfds[i].fd].append(buf, r);
+        continue;
+      }
+      // worker is done
+      add_state(states[pfds[i].fd]);
+      states.erase(pfds[i].fd);
+      close(pfds[i].fd);
+      pfds.erase(pfds.begin()+i);
+      i--;
+    }
+
+    if(!(pfds[0].revents & POLLIN))
+      continue;
+    int conn = accept4(fd, NULL, NULL, SOCK_CLOEXEC);
+    if(conn < 0)
+    {
+      if(errno == EINTR || errno == ECONNABORTED || errno == EAGAIN)
+        continue;
+      close(fd);
+      throw std::runtime_error(strf("accept() failed: %s", strerror(errno)));
+    }
+    // runs have the rights of the daemon: only serve its user
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+    int statefds[2];
+    if(getsockopt(conn, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0 || cred.uid != geteuid()
+      || pipe2(statefds, O_CLOEXEC) < 0)
+    {
+      close(conn);
+      continue;
+    }
+    pid_t pid = fork();
+    if(pid == 0)
+    {
+      for(auto& it: pfds)
+        close(it.fd);
+      close(statefds[0]);
+      signal(SIGCHLD, SIG_DFL);
+      _exit(serve_request(conn, statefds[1], fct, get_state));
+    }
+    close(conn);
+    close(statefds[1]);
+    if(pid < 0)
+      close(statefds[0]);
+    else
+      pfds.push_back({ statefds[0], POLLIN, 0 });
+  }
+}
@@ -1,6 +1,7 @@
 #include "debashify.hpp"
 
 #include <algorithm>
+#include <vector>
 
 #include <ztd/options.hpp>
 
@@ -9,6 +10,7 @@
 #include "util.hpp"
 #include "parse.hpp"
 #include "struc_helper.hpp"
+#include "options.hpp"
 
 #include "g_shellcode.h"
 
@@ -387,14 +389,8 @@ bool debashify_declare(list_t* in, debashify_params* params)
 
 cmd_t* make_cmd_varindex(std::string const& strcmd, std::string const& varname, arg_t* index)
 {
-  cmd_t* c = new cmd_t(new arglist_t);
-  // cmd
-  c->args->add( new arg_t(strcmd) );
-  // cmd "$VAR"
-  c->args->add( make_arg("\"$"+varname+"\"") );
   // cmd "$VAR" N
-  c->args->add( index );
-  return c;
+  return make_cmd(std::vector<arg_t*>({new arg_t(strcmd), make_quoted_var(varname), index}));
 }
 
 subshell_t* do_debashify_array_var_get(variable_t* in, debashify_params* params)
@@ -623,7 +619,7 @@ bool debashify_array_set(cmd_t* in, debashify_params* params)
         params->require_fct("_lxsh_array_set");
       }
       // _lxsh_array_set "$VAR"
-      c->args->add( make_arg("\"$"+varname+"\"") );
+      c->args->add( make_quoted_var(varname) );
       // _lxsh_array_set "$VAR" N
       c->args->add( index );
       // _lxsh_array_set "$VAR" N value
@@ -660,7 +656,7 @@ bool debashify_array_set(cmd_t* in, debashify_params* params)
         params->require_fct("_lxsh_array_create");
       }
       // second arg is varname
-      c->args->insert(1, make_arg("\"$"+varname+"\"") );
+      c->args->insert(1, make_quoted_var(varname) );
       subarg_subshell_t* sb = new subarg_subshell_t(new subshell_t(c));
       // insert new value
       delete it->second;
@@ -701,9 +697,7 @@ bool debashify_herestring(pipeline_t* pl)
       if(c->redirs[i]->op == "<<<")
       {
         force_quotes(c->redirs[i]->target);
-        cmd_t* printcmd = make_cmd("printf %s\\\\n");
-        printcmd->add(c->redirs[i]->target);
-        pl->cmds.insert(pl->cmds.begin(), printcmd);
+        pl->cmds.insert(pl->cmds.begin(), make_cmd("printf %s\\\\n @1", {c->redirs[i]->target}) );
 
         // cleanup
         c->redirs[i]->target=nullptr;
@@ -798,34 +792,26 @@ bool debashify_procsub(list_t* lst, debashify_params* params)
       params->require_fct("_lxsh_random_tmpfile");
       has_replaced=true;
       list_t* lst_insert = new list_t;
-      std::string mkfifocmd="mkfifo";
+      cmd_t* mkfifocmd = make_cmd(std::vector<const char*>({"mkfifo"}));
       for(uint32_t i=0; i<affected_args.size(); i++)
       {
         // fifoN=${TMPDIR-/tmp}/lxshfifo_$(_lxsh_random_string 10)
-        lst_insert->add( make_condlist( strf("_lxshfifo%u=$(_lxsh_random_tmpfile lxshfifo)", i) ) );
-        mkfifocmd += strf(" \"$_lxshfifo%u\"", i);
+        cmd_t* c = new cmd_t;
+        c->var_assigns.push_back(std::make_pair(new variable_t(strf("_lxshfifo%u", i), nullptr, true), make_arg("=$(_lxsh_random_tmpfile lxshfifo)")));
+        lst_insert->add(new condlist_t(c));
+        mkfifocmd->add(make_quoted_var(strf("_lxshfifo%u", i)));
       }
       // mkfifo "$fifoN"
-      lst_insert->add( make_condlist(mkfifocmd) );
+      lst_insert->add(new condlist_t(mkfifocmd));
       for(uint32_t i=0; i<affected_args.size(); i++)
       {
-        // create ( {PSUB;} > "$fifoN" ; rm "$fifoN") &
-        subshell_t* psub = new subshell_t(new list_t);
         subarg_procsub_t* st = dynamic_cast<subarg_procsub_t*>(affected_args[i].first->sa[0]);
         // {PSUB;}
         brace_t* cbr = new brace_t(st->sbsh->lst);
         // deindex list for delete
         st->sbsh->lst=nullptr;
-        // {PSUB;} > "$_lxshfifoN"
-        cbr->redirs.push_back( new redirect_t( affected_args[i].second ? "<" : ">", make_arg(strf("\"$_lxshfifo%u\"", i)) ) );
-        // ( {PSUB;} > "$_lxshfifoN" )
-        psub->lst->add( new condlist_t(cbr) );
-        // ( {PSUB;} > "$_lxshfifoN" ; rm "$_lxshfifoN" )
-        psub->lst->add( make_condlist(strf("rm \"$_lxshfifo%u\"", i)) );
         // ( {PSUB;} > "$_lxshfifoN" ; rm "$_lxshfifoN" ) &
-        condlist_t* pscl = new condlist_t(psub);
-        pscl->parallel=true;
-        lst_insert->add( pscl );
+        lst_insert->add( make_condlist( affected_args[i].second ? "( @1 <@2 ; rm @2 ) &" : "( @1 >@2 ; rm @2 ) &", {cbr, make_quoted_var(strf("_lxshfifo%u", i))} ) );
 
         // replace the arg
         delete affected_args[i].first->sa[0];
@@ -843,6 +829,39 @@ bool debashify_procsub(list_t* lst, debashify_params* params)
   return has_replaced;
 }
 
+std::string trim_string(std::string const& in)
+{
+  size_t start = in.find_first_not_of(SPACES);
+  if(start == std::string::npos)
+    return "";
+  return in.substr(start, in.find_last_not_of(SPACES)-start+1);
+}
+
+bool is_uint_string(std::string const& in)
+{
+  std::string t = trim_string(in);
+  if(t == "")
+    return false;
+  for(auto it: t)
+    if(!is_num(it))
+      return false;
+  return true;
+}
+
+// integer constants are passed as is, anything else is passed quoted
+// and evaluated as an arithmetic expression by _lxsh_substring
+arg_t* make_substring_arg(arg_t* in)
+{
+  std::string str = in->string();
+  if(in->is_string() && (is_uint_string(str) || (trim_string(str)[0] == '-' && is_uint_string(trim_string(str).substr(1)))) )
+  {
+    in->set(trim_string(str));
+    return in;
+  }
+  add_quotes(in);
+  return in;
+}
+
 condlist_t* debashify_manipulation_substring(variable_t* v, debashify_params* params)
 {
   subarg_string_t* first = dynamic_cast<subarg_string_t*>(v->manip->sa[0]);
@@ -896,31 +915,28 @@ condlist_t* debashify_manipulation_substring(variable_t* v, debashify_params* pa
     v->manip = nullptr;
   }
 
-  pipeline_t* pl = new pipeline_t(make_printf_variable(v->varname));
-  arg_t* retarg = new arg_t;
-  retarg->add(new subarg_arithmetic_t(make_arithmetic(arg1, "+", new arg_t("1"))));
-  retarg->add("-");
-  pl->add(make_cmd({new arg_t("cut"), new arg_t("-c"), retarg}));
+  if(v->manip != nullptr)
+    delete v->manip;
+  v->manip = nullptr;
 
-  if(arg2 != nullptr)
+  cmd_t* c;
+  if(arg2 != nullptr && is_uint_string(arg1->string()) && std::stoul(arg1->string()) == 0 && is_uint_string(arg2->string()))
   {
-    retarg = new arg_t;
-    retarg->add("-");
-    for(auto it: arg2->sa)
-    {
-      retarg->add(it);
-    }
-    arg2->sa.resize(0);
+    // ${VAR:0:N} with constant N: printf %.Ns "$VAR"
+    c = make_cmd({new arg_t("printf"), new arg_t("%."+trim_string(arg2->string())+"s"), make_quoted_var(v->varname)});
+    delete arg1;
     delete arg2;
-    arg2 = nullptr;
-    pl->add(make_cmd({new arg_t("cut"), new arg_t("-c"), retarg}));
+  }
+  else
+  {
+    // _lxsh_substring "$VAR" OFFSET [LENGTH]
+    c = make_cmd({new arg_t("_lxsh_substring"), make_quoted_var(v->varname), make_substring_arg(arg1)});
+    if(arg2 != nullptr)
+      c->add(make_substring_arg(arg2));
+    params->require_fct("_lxsh_substring");
   }
 
-  if(v->manip != nullptr)
-    delete v->manip;
-  v->manip = nullptr;
-
-  return new condlist_t(pl);
+  return new condlist_t(c);
 }
 
 bool debashify_manipulation(arg_t* in, debashify_params* params)
@@ -932,7 +948,7 @@ bool debashify_manipulation(arg_t* in, debashify_params* params)
     {
       variable_t* v = dynamic_cast<subarg_variable_t*>(in->sa[i])->var;
       if(!v->is_manip || v->manip == nullptr)
-        return false;
+        continue;
       std::string manip = v->manip->first_sa_string();
       subarg_t* r = nullptr;
       if(v->is_manip && v->precedence && v->manip->string() == "!")
@@ -1197,6 +1213,29 @@ bool r_debashify(_obj* o, debashify_params* params)
   return true;
 }
 
+// find declared arrays ahead of debashify
+// done on the whole tree so that subtrees can be debashified independently
+bool r_debashify_get_arrays(_obj* o, debashify_params* params)
+{
+  if(o->type != _obj::block_cmd)
+    return true;
+  cmd_t* t = dynamic_cast<cmd_t*>(o);
+  std::string const& cmdstr=t->arg_string(0);
+  if( (cmdstr == "declare" || cmdstr == "typeset") && t->cmd_var_assigns.size()>0 )
+  {
+    std::string const& op = get_declare_opt(t);
+    if(op == "-a" || op == "-A")
+    {
+      for(auto it: t->cmd_var_assigns)
+      {
+        if(it.first != nullptr)
+          params->arrays[it.first->varname] = params->arrays[it.first->varname] || op == "-A";
+      }
+    }
+  }
+  return true;
+}
+
 // return value: dependencies
 std::set<std::string> debashify(_obj* o, debashify_params* params)
 {
@@ -1204,11 +1243,32 @@ std::set<std::string> debashify(_obj* o, debashify_params* params)
   return params->required_fcts;
 }
 
+// debashify entries of the main list concurrently, each with its own copy of params
+// top level modifications of the list are done beforehand
+void debashify_main_list(list_t* lst, debashify_params* params, uint32_t jobs)
+{
+  if(!r_debashify(lst, params))
+    return;
+
+  std::vector<debashify_params> task_params(lst->cls.size(), *params);
+  parallel_for(lst->cls.size(), [&](uint32_t i) {
+    recurse(r_debashify, lst->cls[i], &task_params[i]);
+  }, jobs);
+
+  for(auto const& it: task_params)
+    params->merge(it);
+}
+
 // return value: dependencies
-std::set<std::string> debashify(shmain* sh)
+std::set<std::string> debashify(shmain* sh, uint32_t jobs)
 {
   debashify_params params;
   sh->shebang = "#!/bin/sh";
-  recurse(r_debashify, sh, &params);
+  recurse(r_debashify_get_arrays, sh, &params);
+  r_debashify(sh, &params);
+  if(sh->lst != nullptr)
+    debashify_main_list(sh->lst, &params, jobs);
+  for(auto it: sh->redirs)
+    recurse(r_debashify, it, &params);
   return params.required_fcts;
 }
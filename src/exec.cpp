@@ -1,10 +1,14 @@
 #include "exec.hpp"
 
+#include <algorithm>
+
 #include <unistd.h>
 #include <sys/wait.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <signal.h>
+#include <fcntl.h>
+#include <pthread.h>
 
 #include "g_shellcode.h"
 
@@ -14,11 +18,113 @@
 #include "resolve.hpp"
 #include "recursive.hpp"
 #include "shellcode.hpp"
+#include "cache.hpp"
 
 #define PIPE_READ  0
 #define PIPE_WRITE 1
 
-std::vector<condlist_t*> do_include_exec(condlist_t* cmd, parse_context ctx, FILE* fd)
+stream_writer::stream_writer(int fd, size_t size, size_t chunk) : fd(fd), buffer(size), chunk(std::min(chunk, size))
+{
+  thread = std::thread(&stream_writer::writer, this);
+}
+
+stream_writer::~stream_writer()
+{
+  if(thread.joinable())
+    close();
+}
+
+bool stream_writer::put(std::string const& in)
+{
+  return put(in.c_str(), in.size());
+}
+
+bool stream_writer::put(const char* in, size_t len)
+{
+  std::unique_lock<std::mutex> lock(mtx);
+  while(len > 0)
+  {
+    not_full.wait(lock, [this]{ return count < buffer.size() || is_broken; });
+    if(is_broken)
+      return false;
+    // copy to the end of free space, wrapping around once at most
+    size_t tail = (head+count) % buffer.size();
+    size_t n = std::min(len, buffer.size()-count);
+    size_t n1 = std::min(n, buffer.size()-tail);
+    memcpy(buffer.data()+tail, in, n1);
+    memcpy(buffer.data(), in+n1, n-n1);
+    count += n;
+    in += n;
+    len -= n;
+    if(count >= chunk)
+      not_empty.notify_one();
+  }
+  return true;
+}
+
+void stream_writer::flush()
+{
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    flushing=true;
+  }
+  not_empty.notify_one();
+}
+
+void stream_writer::close()
+{
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    closing=true;
+  }
+  not_empty.notify_one();
+  thread.join();
+  ::close(fd);
+}
+
+void stream_writer::writer()
+{
+  // a reader exiting early should give EPIPE on this thread, not kill lxsh
+  sigset_t set;
+  sigemptyset(&set);
+  sigaddset(&set, SIGPIPE);
+  pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+  std::unique_lock<std::mutex> lock(mtx);
+  while(true)
+  {
+    not_empty.wait(lock, [this]{ return count >= chunk || flushing || closing; });
+    if(count == 0)
+    {
+      if(closing)
+        break;
+      flushing=false;
+      continue;
+    }
+    // write the contiguous part, data stays in place until consumed
+    size_t n = std::min(count, buffer.size()-head);
+    const char* data = buffer.data()+head;
+    lock.unlock();
+    ssize_t r = ::write(fd, data, n);
+    lock.lock();
+    if(r < 0)
+    {
+      if(errno == EINTR)
+        continue;
+      is_broken=true;
+      count=0;
+      not_full.notify_one();
+      break;
+    }
+    head = (head+r) % buffer.size();
+    count -= r;
+    if(count == 0)
+      flushing=false;
+    not_full.notify_one();
+  }
+}
+
+std::vector<condlist_t*> do_include_exec(condlist_t* cmd, parse_context ctx, stream_writer* out, std::set<std::string>* fcts)
 {
   std::vector<condlist_t*> ret;
 
@@ -26,17 +132,15 @@ std::vector<condlist_t*> do_include_exec(condlist_t* cmd, parse_context ctx, FIL
   auto incs=do_include_raw(cmd, ctx, &dir);
 
   for(auto it: incs)
-  {
-    parse_exec(fd, make_context(ctx, it.second, it.first));
-  }
+    parse_exec(out, make_context(ctx, it.second, it.first), fcts);
   // cd back
-  _cd(dir);
+  _cd(dir, ctx.run);
 
   return ret;
 }
 
 // if first is nullptr: is a string
-std::vector<condlist_t*> do_resolve_exec(condlist_t* cmd, parse_context ctx, FILE* fd)
+std::vector<condlist_t*> do_resolve_exec(condlist_t* cmd, parse_context ctx, stream_writer* out, std::set<std::string>* fcts)
 {
   std::vector<condlist_t*> ret;
 
@@ -47,9 +151,9 @@ std::vector<condlist_t*> do_resolve_exec(condlist_t* cmd, parse_context ctx, FIL
     std::string dir;
     p=do_resolve_raw(cmd, ctx, &dir);
     // do parse
-    parse_exec(fd, make_context(ctx, p.second, p.first));
+    parse_exec(out, make_context(ctx, p.second, p.first), fcts);
     // cd back
-    _cd(dir);
+    _cd(dir, ctx.run);
   }
   catch(format_error& e)
   {
@@ -61,7 +165,7 @@ std::vector<condlist_t*> do_resolve_exec(condlist_t* cmd, parse_context ctx, FIL
 
 // -- OBJECT CALLS --
 
-bool resolve_condlist_exec(condlist_t* in, parse_context ctx, FILE* fd)
+bool resolve_condlist_exec(condlist_t* in, parse_context ctx, stream_writer* out, std::set<std::string>* fcts)
 {
   cmd_t* tc = in->first_cmd();
   if(tc == nullptr)
@@ -69,23 +173,25 @@ bool resolve_condlist_exec(condlist_t* in, parse_context ctx, FILE* fd)
 
   std::string const& strcmd=tc->arg_string(0);
 
-  if(g_include && strcmd == "%include")
+  if(ctx.run->include && strcmd == "%include")
   {
-    do_include_exec(in, ctx, fd);
+    do_include_exec(in, ctx, out, fcts);
     return true;
   }
-  else if(g_resolve && strcmd == "%resolve")
+  else if(ctx.run->resolve && strcmd == "%resolve")
   {
-    do_resolve_exec(in, ctx, fd);
+    // the shell can run what was generated so far while the command runs
+    out->flush();
+    do_resolve_exec(in, ctx, out, fcts);
     return true;
   }
   return false;
 }
 
 
-bool resolve_exec(condlist_t* in, parse_context ctx, FILE* fd)
+bool resolve_exec(condlist_t* in, parse_context ctx, stream_writer* out, std::set<std::string>* fcts)
 {
-  if(!resolve_condlist_exec(in, ctx, fd))
+  if(!resolve_condlist_exec(in, ctx, out, fcts))
   {
     resolve(in, ctx);
     return false;
@@ -138,11 +244,12 @@ std::string random_string()
   return ret;
 }
 
-void parse_exec(FILE* fd, parse_context ctx)
+void parse_exec(stream_writer* out, parse_context ctx, std::set<std::string>* fcts)
 {
   ctx.i=skip_unread(ctx);
 
   debashify_params debash_params;
+  bool first=true;
   list_t* t_lst=new list_t;
   if(t_lst == nullptr)
     throw std::runtime_error("Alloc error");
@@ -156,22 +263,47 @@ void parse_exec(FILE* fd, parse_context ctx)
       throw std::runtime_error("Aborting due to previous errors");
     }
     t_lst->add(pp.first);
-    if(g_resolve || g_include)
+    if(ctx.run->resolve || ctx.run->include)
     {
-      if(resolve_exec(t_lst->cls[0], ctx, fd))
+      if(resolve_exec(t_lst->cls[0], ctx, out, fcts))
       {
         t_lst->clear();
         continue;
       }
     }
-    if(options["debashify"])
+    if(ctx.run->options["debashify"])
       debashify(t_lst, &debash_params);
 
+    std::string gen;
+    // output lxsh functions before their first use
+    std::set<std::string> new_fcts;
+    recurse(r_get_lxsh_cmds, t_lst, &new_fcts);
+    exclude_sets(new_fcts, *fcts);
+    if(new_fcts.size() > 0)
+    {
+      new_fcts = lxsh_fcts_depends(new_fcts);
+      exclude_sets(new_fcts, *fcts);
+      concat_sets(*fcts, new_fcts);
+      gen = lxsh_fcts_code(new_fcts);
+    }
 
-    std::string gen=t_lst->generate(0);
+    gen += t_lst->generate(0);
     t_lst->clear();
 
-    fprintf(fd, "%s", gen.c_str());
+    if(g_exec_cache != nullptr)
+      g_exec_cache->output += gen;
+
+    // reader is gone: no point in going further
+    if(!out->put(gen))
+    {
+      if(g_exec_cache != nullptr)
+        g_exec_cache->cacheable=false;
+      break;
+    }
+    // start the shell on the first command
+    if(first)
+      out->flush();
+    first=false;
 
     if(ctx.i < ctx.size)
     {
@@ -201,7 +333,8 @@ pid_t forkexec(const char* bin, char *const args[])
   if (child_pid == 0) // child process
   {
     execv(bin, args);
-    throw std::runtime_error("execv() failed");
+    // can't throw from a vfork child
+    _exit(127);
   }
   else // main process
   {
@@ -224,52 +357,241 @@ int wait_pid(pid_t pid)
   return WEXITSTATUS(stat);
 }
 
+// open the pipe the interpreter reads the script from
+// anonymous pipe given as /dev/fd/N, falls back to a named fifo in $TMPDIR without /dev/fd
+std::string open_exec_pipe(int pipefd[2], std::string* fifopath)
+{
+  if(access("/dev/fd", F_OK) == 0)
+  {
+    if(pipe(pipefd) < 0)
+      throw std::runtime_error("Cannot create pipe");
+    // the interpreter must not hold the write end
+    fcntl(pipefd[PIPE_WRITE], F_SETFD, FD_CLOEXEC);
+    return strf("/dev/fd/%d", pipefd[PIPE_READ]);
+  }
+
+  *fifopath=gettmpdir();
+  *fifopath+="/lxshfiforun_";
+  *fifopath+=random_string();
+  if(mkfifo(fifopath->c_str(), 0700)<0)
+    throw std::runtime_error("Cannot create fifo "+*fifopath);
+  return *fifopath;
+}
+
+// replace lxsh with the interpreter running the cached script
+void exec_cached(std::vector<std::string> const& strargs, std::string const& path, std::vector<std::string> const& args)
+{
+  std::vector<char*> runargs;
+  for(auto& it: strargs)
+    runargs.push_back((char*) it.c_str());
+  runargs.push_back((char*) path.c_str());
+  for(auto& it: args)
+    runargs.push_back((char*) it.c_str());
+  runargs.push_back(NULL);
+  execv(runargs[0], runargs.data());
+  throw std::runtime_error("Cannot execute "+strargs[0]);
+}
+
+// -- SHELL COPROCESS --
+
+shell_coprocess::shell_coprocess()
+{
+  marker = "lxsh_" + random_string();
+
+  int cmdfd[2] = {-1, -1};
+  int outfd[2] = {-1, -1};
+  if(pipe(cmdfd) < 0)
+    throw std::runtime_error("Cannot create pipe");
+  if(pipe(outfd) < 0)
+  {
+    close(cmdfd[PIPE_READ]);
+    close(cmdfd[PIPE_WRITE]);
+    throw std::runtime_error("Cannot create pipe");
+  }
+  for(auto it: {cmdfd[PIPE_READ], cmdfd[PIPE_WRITE], outfd[PIPE_READ], outfd[PIPE_WRITE]})
+    fcntl(it, F_SETFD, FD_CLOEXEC);
+
+  if((pid = fork()) == -1)
+    throw std::runtime_error("fork() failed");
+  if(pid == 0)
+  {
+    // commands are read on stdin like with sh -c, so $0 is sh
+    // stdin of lxsh is kept on fd 3 and given back to the commands
+    int cmdin = fcntl(cmdfd[PIPE_READ], F_DUPFD, 10);
+    dup2(outfd[PIPE_WRITE], STDOUT_FILENO);
+    dup2(STDIN_FILENO, 3);
+    dup2(cmdin, STDIN_FILENO);
+    close(cmdin);
+    execl("/bin/sh", "sh", "-s", (char*) NULL);
+    _exit(127);
+  }
+
+  close(cmdfd[PIPE_READ]);
+  close(outfd[PIPE_WRITE]);
+  in = cmdfd[PIPE_WRITE];
+  out = outfd[PIPE_READ];
+}
+
+shell_coprocess::~shell_coprocess()
+{
+  // end of script: the shell exits
+  if(in >= 0)
+    close(in);
+  if(out >= 0)
+    close(out);
+  if(pid > 0)
+    wait_pid(pid);
+}
+
+std::pair<std::string, int> shell_coprocess::run(std::string const& cmd, std::string const& dir)
+{
+  // eval: a syntax error only ends the subshell
+  std::string script = "( cd -- " + single_quote(dir) + " || exit\neval " + single_quote(cmd) + "\n) <&3 3<&-\n";
+  script += "printf '\\n%s %d\\n' " + marker + " $?\n";
+
+  // don't get SIGPIPE from a dead shell
+  if(waitpid(pid, NULL, WNOHANG) != 0)
+    throw std::runtime_error("Shell coprocess exited");
+  const char* data = script.c_str();
+  size_t len = script.size();
+  while(len > 0)
+  {
+    ssize_t r = write(in, data, len);
+    if(r < 0)
+    {
+      if(errno == EINTR)
+        continue;
+      throw std::runtime_error("Cannot write to shell coprocess");
+    }
+    data += r;
+    len -= r;
+  }
+
+  std::string output;
+  std::string end = '\n' + marker + ' ';
+  // start of the data that can still hold the status line
+  size_t from=0;
+  char buf[4096];
+  while(true)
+  {
+    ssize_t r = read(out, buf, sizeof(buf));
+    if(r < 0 && errno == EINTR)
+      continue;
+    if(r <= 0)
+      throw std::runtime_error("Shell coprocess exited");
+    output.append(buf, r);
+    // status line is the last one
+    size_t i;
+    while( (i = output.find(end, from)) != std::string::npos )
+    {
+      size_t eol = output.find('\n', i+1);
+      if(eol == std::string::npos)
+        break;
+      if(eol == output.size()-1)
+      {
+        int status = std::stoi(output.substr(i+end.size()));
+        output.resize(i);
+        return std::make_pair(output, status);
+      }
+      from = i+1;
+    }
+    if(i == std::string::npos && output.size() >= end.size())
+      from = std::max(from, output.size() - end.size() + 1);
+    else if(i != std::string::npos)
+      from = i;
+  }
+}
+
+std::pair<std::string, int> shell_run(std::string const& cmd, std::string const& dir)
+{
+  // one per thread, so that runs on different threads don't wait for each other
+  thread_local std::unique_ptr<shell_coprocess> shell;
+  if(shell == nullptr)
+    shell = std::make_unique<shell_coprocess>();
+  return shell->run(cmd, dir);
+}
+
 int exec_process(std::string const& runtime, std::vector<std::string> const& args, parse_context ctx)
 {
   std::vector<std::string> strargs = split(runtime, " \t");
   std::vector<char*> runargs;
 
-  std::string fifopath=gettmpdir();
-  fifopath+="/lxshfiforun_";
-  fifopath+=random_string();
+  exec_cache cache;
+  run_context* run = ctx.run;
+  cache.key = exec_cache_key(runtime, ctx.filename, std::string(ctx.data, ctx.size), ctx.bash, run);
+  // nested %include and %resolve are recorded by resolve()
+  size_t n_deps = run->include_deps.size();
+  uint32_t n_unchecked = run->unchecked_resolves;
+  if(cache.key != "")
+  {
+    std::string cached = exec_cache_lookup(cache.key, run);
+    if(cached != "")
+      exec_cached(strargs, cached, args);
+    g_exec_cache = &cache;
+  }
 
-  if(mkfifo(fifopath.c_str(), 0700)<0)
-    throw std::runtime_error("Cannot create fifo "+fifopath);
+  int pipefd[2] = {-1, -1};
+  std::string fifopath;
+  std::string scriptpath = open_exec_pipe(pipefd, &fifopath);
 
   pid_t pid=0;
-  FILE* ffd=0;
+  stream_writer* out=nullptr;
   try
   {
 
     for(uint32_t i=0; i<strargs.size(); i++)
       runargs.push_back((char*) strargs[i].c_str());
-    runargs.push_back((char*) fifopath.c_str());
+    runargs.push_back((char*) scriptpath.c_str());
     for(uint32_t i=0; i<args.size(); i++)
       runargs.push_back((char*) args[i].c_str());
     runargs.push_back(NULL);
 
     pid = forkexec(runargs[0], runargs.data());
-    ffd = fopen(fifopath.c_str(), "w");
-    if(options["debashify"])
+    int fd;
+    if(fifopath != "")
+    {
+      fd = open(fifopath.c_str(), O_WRONLY|O_CLOEXEC);
+      if(fd < 0)
+        throw std::runtime_error("Cannot open fifo "+fifopath);
+    }
+    else
     {
-      for(auto it: lxsh_array_fcts)
-        fprintf(ffd, "%s\n", it.second.code);
+      close(pipefd[PIPE_READ]);
+      fd = pipefd[PIPE_WRITE];
+      pipefd[PIPE_READ] = pipefd[PIPE_WRITE] = -1;
     }
-    for(auto it: lxsh_extend_fcts)
-      fprintf(ffd, "%s\n", it.second.code);
-    parse_exec(ffd, ctx);
+    out = new stream_writer(fd);
+    std::set<std::string> fcts;
+    parse_exec(out, ctx, &fcts);
   }
   catch(std::runtime_error& e)
   {
+    g_exec_cache = nullptr;
     if(pid != 0)
       kill(pid, SIGINT);
-    fclose(ffd);
-    unlink(fifopath.c_str());
+    delete out;
+    for(auto it: pipefd)
+      if(it >= 0)
+        close(it);
+    if(fifopath != "")
+      unlink(fifopath.c_str());
     throw e;
   }
 
-  fclose(ffd);
-  unlink(fifopath.c_str());
+  delete out;
+  if(fifopath != "")
+    unlink(fifopath.c_str());
+
+  if(g_exec_cache != nullptr)
+  {
+    g_exec_cache = nullptr;
+    // command outputs can't be checked without running them
+    if(run->unchecked_resolves != n_unchecked)
+      cache.cacheable=false;
+    for(size_t i=n_deps; i<run->include_deps.size(); i++)
+      cache.deps.push_back(std::make_pair(run->include_deps[i].path, run->include_deps[i].hash));
+    exec_cache_store(cache, run);
+  }
 
   return wait_pid(pid);
 }
@@ -7,7 +7,7 @@
 #include "parse.hpp"
 
 // global
-bool prev_is_heredoc=false;
+thread_local bool prev_is_heredoc=false;
 
 bool is_sub_special_cmd(std::string in)
 {
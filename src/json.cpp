@@ -0,0 +1,305 @@
+#include "json.hpp"
+
+#include <stdexcept>
+#include <cmath>
+
+#include <string.h>
+
+#include "util.hpp"
+
+const json json_null;
+
+json const& json::operator[](std::string const& key) const
+{
+  if(type != object)
+    return json_null;
+  auto it = obj.find(key);
+  if(it == obj.end())
+    return json_null;
+  return it->second;
+}
+
+json& json::operator[](std::string const& key)
+{
+  type=object;
+  return obj[key];
+}
+
+void json::push_back(json const& in)
+{
+  type=array;
+  arr.push_back(in);
+}
+
+// DUMP //
+
+static void dump_string(std::string const& in, std::string& out)
+{
+  out += '"';
+  for(unsigned char c: in)
+  {
+    switch(c)
+    {
+      case '"': out += "\\\""; break;
+      case '\\': out += "\\\\"; break;
+      case '\n': out += "\\n"; break;
+      case '\r': out += "\\r"; break;
+      case '\t': out += "\\t"; break;
+      default:
+        if(c < 0x20)
+          out += strf("\\u%04x", c);
+        else
+          out += c;
+    }
+  }
+  out += '"';
+}
+
+static void dump_value(json const& in, std::string& out)
+{
+  switch(in.type)
+  {
+    case json::null: out += "null"; break;
+    case json::boolean: out += in.b ? "true" : "false"; break;
+    case json::number:
+      if(in.num == std::floor(in.num) && std::fabs(in.num) < 1e15)
+        out += std::to_string((int64_t) in.num);
+      else
+        out += strf("%.17g", in.num);
+      break;
+    case json::string: dump_string(in.str, out); break;
+    case json::array:
+      out += '[';
+      for(uint32_t i=0; i<in.arr.size(); i++)
+      {
+        if(i > 0)
+          out += ',';
+        dump_value(in.arr[i], out);
+      }
+      out += ']';
+      break;
+    case json::object: {
+      out += '{';
+      bool first=true;
+      for(auto& it: in.obj)
+      {
+        if(!first)
+          out += ',';
+        first=false;
+        dump_string(it.first, out);
+        out += ':';
+        dump_value(it.second, out);
+      }
+      out += '}';
+    }; break;
+  }
+}
+
+std::string json::dump() const
+{
+  std::string ret;
+  dump_value(*this, ret);
+  return ret;
+}
+
+// PARSE //
+
+// nested arrays and objects, parsing is recursive
+#define JSON_MAX_DEPTH 512
+
+struct json_parser {
+  std::string const& in;
+  uint64_t i=0;
+  uint32_t depth=0;
+
+  void error(std::string const& message) {
+    throw std::runtime_error(strf("Invalid JSON at %lu: %s", (unsigned long) i, message.c_str()));
+  }
+  void skip_spaces() {
+    while(i<in.size() && (in[i] == ' ' || in[i] == '\t' || in[i] == '\n' || in[i] == '\r'))
+      i++;
+  }
+  void expect(char c) {
+    skip_spaces();
+    if(i >= in.size() || in[i] != c)
+      error(strf("expecting '%c'", c));
+    i++;
+  }
+  bool word(const char* w) {
+    uint64_t len = strlen(w);
+    if(in.compare(i, len, w) != 0)
+      return false;
+    i += len;
+    return true;
+  }
+
+  void add_utf8(uint32_t cp, std::string& out) {
+    if(cp < 0x80)
+      out += (char) cp;
+    else if(cp < 0x800) {
+      out += (char) (0xC0 | (cp >> 6));
+      out += (char) (0x80 | (cp & 0x3F));
+    }
+    else if(cp < 0x10000) {
+      out += (char) (0xE0 | (cp >> 12));
+      out += (char) (0x80 | ((cp >> 6) & 0x3F));
+      out += (char) (0x80 | (cp & 0x3F));
+    }
+    else {
+      out += (char) (0xF0 | (cp >> 18));
+      out += (char) (0x80 | ((cp >> 12) & 0x3F));
+      out += (char) (0x80 | ((cp >> 6) & 0x3F));
+      out += (char) (0x80 | (cp & 0x3F));
+    }
+  }
+
+  uint32_t hex4() {
+    if(i+4 > in.size())
+      error("bad unicode escape");
+    uint32_t ret=0;
+    for(int n=0; n<4; n++, i++)
+    {
+      char c = in[i];
+      ret <<= 4;
+      if(c >= '0' && c <= '9') ret |= c-'0';
+      else if(c >= 'a' && c <= 'f') ret |= c-'a'+10;
+      else if(c >= 'A' && c <= 'F') ret |= c-'A'+10;
+      else error("bad unicode escape");
+    }
+    return ret;
+  }
+
+  std::string parse_string() {
+    expect('"');
+    std::string ret;
+    while(true)
+    {
+      if(i >= in.size())
+        error("unterminated string");
+      char c = in[i++];
+      if(c == '"')
+        return ret;
+      if(c != '\\')
+      {
+        ret += c;
+        continue;
+      }
+      if(i >= in.size())
+        error("unterminated string");
+      c = in[i++];
+      switch(c)
+      {
+        case '"': case '\\': case '/': ret += c; break;
+        case 'b': ret += '\b'; break;
+        case 'f': ret += '\f'; break;
+        case 'n': ret += '\n'; break;
+        case 'r': ret += '\r'; break;
+        case 't': ret += '\t'; break;
+        case 'u': {
+          uint32_t cp = hex4();
+          // surrogate pair
+          if(cp >= 0xD800 && cp < 0xDC00 && in.compare(i, 2, "\\u") == 0)
+          {
+            i += 2;
+            uint32_t low = hex4();
+            cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+          }
+          add_utf8(cp, ret);
+        }; break;
+        default: error("bad escape");
+      }
+    }
+  }
+
+  json parse_value() {
+    skip_spaces();
+    if(i >= in.size())
+      error("unexpected end");
+    char c = in[i];
+    if((c == '{' || c == '[') && depth >= JSON_MAX_DEPTH)
+      error("too deeply nested");
+    if(c == '{')
+    {
+      json ret = json::new_object();
+      i++;
+      skip_spaces();
+      if(i < in.size() && in[i] == '}')
+      {
+        i++;
+        return ret;
+      }
+      depth++;
+      while(true)
+      {
+        skip_spaces();
+        std::string key = parse_string();
+        expect(':');
+        ret.obj[key] = parse_value();
+        skip_spaces();
+        if(i < in.size() && in[i] == ',')
+          i++;
+        else
+        {
+          expect('}');
+          depth--;
+          return ret;
+        }
+      }
+    }
+    else if(c == '[')
+    {
+      json ret = json::new_array();
+      i++;
+      skip_spaces();
+      if(i < in.size() && in[i] == ']')
+      {
+        i++;
+        return ret;
+      }
+      depth++;
+      while(true)
+      {
+        ret.arr.push_back(parse_value());
+        skip_spaces();
+        if(i < in.size() && in[i] == ',')
+          i++;
+        else
+        {
+          expect(']');
+          depth--;
+          return ret;
+        }
+      }
+    }
+    else if(c == '"')
+      return json(parse_string());
+    else if(word("true"))
+      return json(true);
+    else if(word("false"))
+      return json(false);
+    else if(word("null"))
+      return json();
+    else if(c == '-' || (c >= '0' && c <= '9'))
+    {
+      const char* start = in.c_str()+i;
+      char* end;
+      double val = strtod(start, &end);
+      if(end == start)
+        error("bad number");
+      i += end-start;
+      return json(val);
+    }
+    error(strf("unexpected '%c'", c));
+    return json();
+  }
+};
+
+json json::parse(std::string const& in)
+{
+  json_parser p = { .in=in };
+  json ret = p.parse_value();
+  p.skip_spaces();
+  if(p.i < in.size())
+    p.error("trailing data");
+  return ret;
+}
@@ -0,0 +1,647 @@
+#include "lsp.hpp"
+
+#include <map>
+#include <set>
+#include <memory>
+#include <algorithm>
+#include <stdexcept>
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <glob.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#include "json.hpp"
+#include "parse.hpp"
+#include "struc.hpp"
+#include "recursive.hpp"
+#include "util.hpp"
+#include "version.h"
+
+// JSON-RPC error codes
+#define LSP_PARSE_ERROR      -32700
+#define LSP_METHOD_NOT_FOUND -32601
+#define LSP_INVALID_PARAMS   -32602
+#define LSP_INTERNAL_ERROR   -32603
+
+// past this, diagnostics are mostly consequences of the first ones
+#define LSP_MAX_DIAGNOSTICS 100
+
+// Content-Length of a message, larger ones are discarded
+#define LSP_MAX_MESSAGE (64*1024*1024)
+
+class lsp_error : public std::runtime_error
+{
+public:
+  lsp_error(int c, std::string const& message) : std::runtime_error(message) { code=c; }
+  int code;
+};
+
+static void send_message(json const& msg)
+{
+  std::string out = msg.dump();
+  printf("Content-Length: %lu\r\n\r\n%s", (unsigned long) out.size(), out.c_str());
+  fflush(stdout);
+}
+
+/** INDEX **/
+
+// variable or function name in a top-level command
+struct lsp_symbol {
+  bool fct; // function, variable otherwise
+  bool definition;
+  std::string name;
+  // position from the start of the top-level command
+  uint64_t pos;
+};
+
+// index of a top-level command
+struct lsp_chunk {
+  std::vector<lsp_symbol> symbols;
+  // files given to %include
+  std::vector<std::string> includes;
+};
+
+struct lsp_scan {
+  lsp_chunk* chunk;
+  uint64_t start;
+  std::string dir;
+};
+
+// static %include arguments, relative to the folder of the file
+static void add_includes(cmd_t* cmd, lsp_scan* scan)
+{
+  for(uint32_t i=1; i<cmd->arglist_size(); i++)
+  {
+    arg_t* arg = cmd->args->args[i];
+    std::string path = arg->string();
+    if(!arg->is_string() || path == "" || path[0] == '-' || path.find_first_of("\"'") != std::string::npos)
+      continue;
+    if(path[0] != '/')
+      path = scan->dir + '/' + path;
+    if(path.find_first_of("*?[") == std::string::npos)
+    {
+      scan->chunk->includes.push_back(path);
+      continue;
+    }
+    glob_t gl;
+    if(glob(path.c_str(), 0, NULL, &gl) == 0)
+    {
+      for(size_t j=0; j<gl.gl_pathc; j++)
+        scan->chunk->includes.push_back(gl.gl_pathv[j]);
+    }
+    globfree(&gl);
+  }
+}
+
+bool r_lsp_scan(_obj* in, lsp_scan* scan)
+{
+  std::vector<lsp_symbol>& symbols = scan->chunk->symbols;
+  switch(in->type)
+  {
+    case _obj::variable: {
+      variable_t* t = dynamic_cast<variable_t*>(in);
+      if(valid_name(t->varname))
+        symbols.push_back({false, t->definition, t->varname, t->pos - scan->start});
+    }; break;
+    case _obj::block_function: {
+      function_t* t = dynamic_cast<function_t*>(in);
+      if(valid_name(t->name))
+        symbols.push_back({true, true, t->name, t->pos - scan->start});
+    }; break;
+    case _obj::block_cmd: {
+      cmd_t* t = dynamic_cast<cmd_t*>(in);
+      std::string const& name = t->arg_string(0);
+      if(name == "%include")
+        add_includes(t, scan);
+      else if(valid_name(name))
+        symbols.push_back({true, false, name, t->pos - scan->start});
+    }; break;
+    default: break;
+  }
+  return true;
+}
+
+/** DOCUMENTS **/
+
+static bool is_file_uri(std::string const& uri)
+{
+  return uri.compare(0, 7, "file://") == 0;
+}
+
+static std::string uri_to_path(std::string const& uri)
+{
+  std::string ret;
+  for(uint64_t i=7; i<uri.size(); i++)
+  {
+    if(uri[i] == '%' && i+2 < uri.size())
+    {
+      ret += (char) strtol(uri.substr(i+1, 2).c_str(), NULL, 16);
+      i+=2;
+    }
+    else
+      ret += uri[i];
+  }
+  return ret;
+}
+
+static std::string path_to_uri(std::string const& path)
+{
+  std::string ret = "file://";
+  for(unsigned char c: path)
+  {
+    if(is_alphanum(c) || strchr("/-._~", c) != NULL)
+      ret += c;
+    else
+      ret += strf("%%%02X", c);
+  }
+  return ret;
+}
+
+static std::string real_path(std::string const& path)
+{
+  char buf[PATH_MAX];
+  if(realpath(path.c_str(), buf) == NULL)
+    return path;
+  return buf;
+}
+
+class lsp_document
+{
+public:
+  lsp_document(std::string const& id, std::string const& text) {
+    uri = id;
+    if(is_file_uri(uri))
+      path = uri_to_path(uri);
+    bash = path.size() > 5 && path.compare(path.size()-5, 5, ".bash") == 0;
+    tree = std::make_unique<parse_tree>(text, path, bash);
+    update();
+  }
+
+  std::string uri;
+  std::string path;
+  bool bash;
+  // open in the client, otherwise read from disk
+  bool open=false;
+  time_t mtime=0;
+
+  std::unique_ptr<parse_tree> tree;
+  std::vector<lsp_chunk> chunks;
+
+  void edit(uint64_t start, uint64_t end, std::string const& str) {
+    tree->edit(start, end, str);
+    update();
+  }
+  void set_text(std::string const& text) {
+    tree = std::make_unique<parse_tree>(text, path, bash);
+    chunks.clear();
+    update();
+  }
+
+  // LSP positions are lines and UTF-16 characters
+  uint64_t offset(json const& position);
+  json position(uint64_t offset);
+  json range(uint64_t start, uint64_t end) {
+    json ret;
+    ret["start"] = position(start);
+    ret["end"] = position(end);
+    return ret;
+  }
+
+private:
+  // index the commands of the last parse
+  void update();
+
+  // start of each line, computed when needed
+  std::vector<uint64_t> lines;
+  void get_lines();
+};
+
+void lsp_document::update()
+{
+  lines.clear();
+  std::vector<lsp_chunk> newchunks(tree->parsed);
+  lsp_scan scan;
+  scan.dir = dirname(path);
+  for(uint32_t i=0; i<tree->parsed; i++)
+  {
+    scan.chunk = &newchunks[i];
+    scan.start = tree->starts()[tree->first+i];
+    recurse(r_lsp_scan, tree->sh->lst->cls[tree->first+i], &scan);
+  }
+  chunks.erase(chunks.begin()+tree->first, chunks.begin()+tree->first+tree->removed);
+  chunks.insert(chunks.begin()+tree->first, newchunks.begin(), newchunks.end());
+}
+
+void lsp_document::get_lines()
+{
+  if(lines.size() > 0)
+    return;
+  std::string const& text = tree->text();
+  lines.push_back(0);
+  for(uint64_t i=0; i<text.size(); i++)
+    if(text[i] == '\n')
+      lines.push_back(i+1);
+}
+
+uint64_t lsp_document::offset(json const& position)
+{
+  std::string const& text = tree->text();
+  get_lines();
+  int64_t line = position["line"].integer();
+  int64_t character = position["character"].integer();
+  if(line < 0)
+    return 0;
+  if((uint64_t) line >= lines.size())
+    return text.size();
+  uint64_t i = lines[line];
+  for(int64_t units=0; i<text.size() && text[i] != '\n' && units < character; )
+  {
+    unsigned char c = text[i];
+    uint32_t len = c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : c >= 0xC0 ? 2 : 1;
+    units += len == 4 ? 2 : 1;
+    i += len;
+  }
+  return std::min(i, (uint64_t) text.size());
+}
+
+json lsp_document::position(uint64_t offset)
+{
+  std::string const& text = tree->text();
+  offset = std::min(offset, (uint64_t) text.size());
+  get_lines();
+  uint64_t line = std::upper_bound(lines.begin(), lines.end(), offset) - lines.begin() - 1;
+  uint64_t character=0;
+  for(uint64_t i=lines[line]; i<offset; i++)
+  {
+    unsigned char c = text[i];
+    if((c & 0xC0) != 0x80)
+      character += c >= 0xF0 ? 2 : 1;
+  }
+  json ret;
+  ret["line"] = line;
+  ret["character"] = character;
+  return ret;
+}
+
+/** SERVER **/
+
+class lsp_server
+{
+public:
+  // handle a message, return false on exit
+  bool handle(json const& msg);
+
+  int status=1;
+
+private:
+  json request(std::string const& method, json const& params);
+  void notification(std::string const& method, json const& params);
+
+  void publish_diagnostics(lsp_document* doc, bool clear=false);
+
+  // documents by path, or by uri if not a file
+  std::map<std::string, std::unique_ptr<lsp_document>> documents;
+  static std::string key(std::string const& uri) { return is_file_uri(uri) ? real_path(uri_to_path(uri)) : uri; }
+  lsp_document* get_document(json const& params);
+  // read a file from disk, again if it changed
+  lsp_document* get_file(std::string const& path);
+  // open documents and the files they include
+  std::vector<lsp_document*> project();
+
+  // symbol at a position of the request
+  bool symbol_at(json const& params, lsp_symbol* ret);
+  // occurrences of a symbol
+  json locations(lsp_symbol const& sym, bool definitions, bool only_definitions);
+
+  bool shutdown=false;
+};
+
+lsp_document* lsp_server::get_document(json const& params)
+{
+  auto it = documents.find(key(params["textDocument"]["uri"].str));
+  if(it == documents.end())
+    throw std::runtime_error("Unknown document");
+  return it->second.get();
+}
+
+lsp_document* lsp_server::get_file(std::string const& path)
+{
+  std::string rpath = real_path(path);
+  auto it = documents.find(rpath);
+  struct stat st;
+  if(stat(rpath.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+    return it != documents.end() && it->second->open ? it->second.get() : nullptr;
+  if(it != documents.end())
+  {
+    lsp_document* doc = it->second.get();
+    if(!doc->open && doc->mtime != st.st_mtime)
+    {
+      doc->set_text(import_file(rpath));
+      doc->mtime = st.st_mtime;
+    }
+    return doc;
+  }
+  auto doc = std::make_unique<lsp_document>(path_to_uri(rpath), import_file(rpath));
+  doc->mtime = st.st_mtime;
+  return (documents[rpath] = std::move(doc)).get();
+}
+
+std::vector<lsp_document*> lsp_server::project()
+{
+  std::vector<lsp_document*> ret;
+  std::set<lsp_document*> seen;
+  for(auto& it: documents)
+  {
+    if(it.second->open && seen.insert(it.second.get()).second)
+      ret.push_back(it.second.get());
+  }
+  for(uint32_t i=0; i<ret.size(); i++)
+  {
+    for(auto& chunk: ret[i]->chunks)
+    {
+      for(auto& inc: chunk.includes)
+      {
+        lsp_document* doc = get_file(inc);
+        if(doc != nullptr && seen.insert(doc).second)
+          ret.push_back(doc);
+      }
+    }
+  }
+  return ret;
+}
+
+bool lsp_server::symbol_at(json const& params, lsp_symbol* ret)
+{
+  lsp_document* doc = get_document(params);
+  uint64_t offset = doc->offset(params["position"]);
+  std::vector<uint64_t> const& starts = doc->tree->starts();
+  int64_t k = std::upper_bound(starts.begin(), starts.end(), offset) - starts.begin() - 1;
+  // here-documents can be after the start of the next command
+  for(int64_t i=k; i>=0 && i>=k-1; i--)
+  {
+    for(auto& it: doc->chunks[i].symbols)
+    {
+      uint64_t pos = starts[i] + it.pos;
+      if(pos <= offset && offset <= pos + it.name.size())
+      {
+        *ret = it;
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+json lsp_server::locations(lsp_symbol const& sym, bool definitions, bool only_definitions)
+{
+  json ret = json::new_array();
+  for(auto doc: project())
+  {
+    std::vector<uint64_t> const& starts = doc->tree->starts();
+    for(uint32_t i=0; i<doc->chunks.size(); i++)
+    {
+      for(auto& it: doc->chunks[i].symbols)
+      {
+        if(it.fct != sym.fct || it.name != sym.name || (it.definition ? !definitions : only_definitions))
+          continue;
+        uint64_t pos = starts[i] + it.pos;
+        // the name must be as is in the text
+        if(doc->tree->text().compare(pos, it.name.size(), it.name) != 0)
+          continue;
+        json loc;
+        loc["uri"] = doc->uri;
+        loc["range"] = doc->range(pos, pos + it.name.size());
+        ret.push_back(loc);
+      }
+    }
+  }
+  return ret;
+}
+
+void lsp_server::publish_diagnostics(lsp_document* doc, bool clear)
+{
+  json params;
+  params["uri"] = doc->uri;
+  params["diagnostics"] = json::new_array();
+  std::vector<parse_diagnostic>& errors = doc->tree->errors;
+  for(uint32_t i=0; !clear && i<errors.size() && i<LSP_MAX_DIAGNOSTICS; i++)
+  {
+    json diag;
+    diag["range"] = doc->range(errors[i].i, errors[i].i+1);
+    diag["severity"] = 1;
+    diag["source"] = "lxsh";
+    diag["message"] = errors[i].message;
+    params["diagnostics"].push_back(diag);
+  }
+  json msg;
+  msg["jsonrpc"] = "2.0";
+  msg["method"] = "textDocument/publishDiagnostics";
+  msg["params"] = params;
+  send_message(msg);
+}
+
+void lsp_server::notification(std::string const& method, json const& params)
+{
+  if(method == "textDocument/didOpen")
+  {
+    json const& td = params["textDocument"];
+    auto doc = std::make_unique<lsp_document>(td["uri"].str, td["text"].str);
+    doc->open = true;
+    lsp_document* t = doc.get();
+    documents[key(td["uri"].str)] = std::move(doc);
+    publish_diagnostics(t);
+  }
+  else if(method == "textDocument/didChange")
+  {
+    lsp_document* doc = get_document(params);
+    for(auto& it: params["contentChanges"].arr)
+    {
+      if(it.has("range"))
+        doc->edit(doc->offset(it["range"]["start"]), doc->offset(it["range"]["end"]), it["text"].str);
+      else
+        doc->set_text(it["text"].str);
+    }
+    publish_diagnostics(doc);
+  }
+  else if(method == "textDocument/didClose")
+  {
+    auto it = documents.find(key(params["textDocument"]["uri"].str));
+    if(it != documents.end())
+    {
+      publish_diagnostics(it->second.get(), true);
+      // read again from disk if included
+      documents.erase(it);
+    }
+  }
+}
+
+json lsp_server::request(std::string const& method, json const& params)
+{
+  if(method == "initialize")
+  {
+    json ret;
+    json& cap = ret["capabilities"];
+    cap["textDocumentSync"]["openClose"] = true;
+    // incremental changes
+    cap["textDocumentSync"]["change"] = 2;
+    cap["definitionProvider"] = true;
+    cap["referencesProvider"] = true;
+    cap["renameProvider"] = true;
+    ret["serverInfo"]["name"] = "lxsh";
+    ret["serverInfo"]["version"] = VERSION_STRING;
+    return ret;
+  }
+  else if(method == "shutdown")
+  {
+    shutdown=true;
+    return json();
+  }
+  else if(method == "textDocument/definition")
+  {
+    lsp_symbol sym;
+    if(!symbol_at(params, &sym))
+      return json();
+    return locations(sym, true, true);
+  }
+  else if(method == "textDocument/references")
+  {
+    lsp_symbol sym;
+    if(!symbol_at(params, &sym))
+      return json();
+    return locations(sym, params["context"]["includeDeclaration"].b, false);
+  }
+  else if(method == "textDocument/rename")
+  {
+    // replace the names in the text, generating from the tree would lose formatting and comments
+    std::string const& name = params["newName"].str;
+    if(!valid_name(name))
+      throw lsp_error(LSP_INVALID_PARAMS, "Invalid name: '"+name+"'");
+    lsp_symbol sym;
+    if(!symbol_at(params, &sym))
+      return json();
+    json ret;
+    ret["changes"] = json::new_object();
+    for(auto& it: locations(sym, true, false).arr)
+    {
+      json edit;
+      edit["range"] = it["range"];
+      edit["newText"] = name;
+      ret["changes"][it["uri"].str].push_back(edit);
+    }
+    return ret;
+  }
+  throw lsp_error(LSP_METHOD_NOT_FOUND, "Unknown method: "+method);
+}
+
+bool lsp_server::handle(json const& msg)
+{
+  std::string const& method = msg["method"].str;
+  if(!msg.has("id"))
+  {
+    if(method == "exit")
+    {
+      status = shutdown ? 0 : 1;
+      return false;
+    }
+    try
+    {
+      notification(method, msg["params"]);
+    }
+    catch(std::exception& e)
+    {
+      fprintf(stderr, "lxsh: %s: %s\n", method.c_str(), e.what());
+    }
+    return true;
+  }
+  if(method == "")
+    return true; // response to a request of ours
+
+  json resp;
+  resp["jsonrpc"] = "2.0";
+  resp["id"] = msg["id"];
+  try
+  {
+    resp["result"] = request(method, msg["params"]);
+  }
+  catch(lsp_error& e)
+  {
+    resp["error"]["code"] = e.code;
+    resp["error"]["message"] = e.what();
+  }
+  catch(std::exception& e)
+  {
+    resp["error"]["code"] = LSP_INTERNAL_ERROR;
+    resp["error"]["message"] = e.what();
+  }
+  send_message(resp);
+  return true;
+}
+
+/** PROTOCOL **/
+
+// read the content of a message, false at end of input
+// throws when it is over LSP_MAX_MESSAGE, after skipping it
+static bool read_message(std::string& out)
+{
+  char line[1024];
+  int64_t len=-1;
+  while(fgets(line, sizeof(line), stdin) != NULL)
+  {
+    if(strcmp(line, "\r\n") == 0 || strcmp(line, "\n") == 0)
+    {
+      if(len < 0)
+        continue;
+      if(len > LSP_MAX_MESSAGE)
+      {
+        // skip the body, the next message can still be read
+        char buf[4096];
+        for(int64_t n=len; n > 0; )
+        {
+          size_t r = fread(buf, 1, std::min((int64_t) sizeof(buf), n), stdin);
+          if(r == 0)
+            return false;
+          n -= r;
+        }
+        throw std::runtime_error(strf("Message of %ld bytes is too large", (long) len));
+      }
+      out.resize(len);
+      return fread(&out[0], 1, len, stdin) == (size_t) len;
+    }
+    if(strncasecmp(line, "Content-Length:", 15) == 0)
+      len = strtoll(line+15, NULL, 10);
+  }
+  return false;
+}
+
+int run_lsp()
+{
+  lsp_server server;
+  std::string data;
+  while(true)
+  {
+    json msg;
+    try
+    {
+      if(!read_message(data))
+        break;
+      msg = json::parse(data);
+    }
+    catch(std::runtime_error& e)
+    {
+      json resp;
+      resp["jsonrpc"] = "2.0";
+      resp["id"] = json();
+      resp["error"]["code"] = LSP_PARSE_ERROR;
+      resp["error"]["message"] = e.what();
+      send_message(resp);
+      continue;
+    }
+    if(!server.handle(msg))
+      return server.status;
+  }
+  return server.status;
+}
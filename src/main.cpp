@@ -17,13 +17,23 @@
 #include "resolve.hpp"
 #include "processing.hpp"
 #include "debashify.hpp"
+#include "optimize.hpp"
+#include "compress.hpp"
 #include "exec.hpp"
+#include "daemon.hpp"
+#include "batch.hpp"
+#include "watch.hpp"
+#include "lsp.hpp"
+#include "session.hpp"
 #include "shellcode.hpp"
 
 #include "errcodes.h"
 
-int main(int argc, char* argv[])
+int lxsh_main(int argc, char* argv[])
 {
+  // options of a new run for the daemon
+  ztd::option_set initial_options=options;
+
   std::vector<std::string> args;
 
   int ret=0;
@@ -43,6 +53,69 @@ int main(int argc, char* argv[])
 
     oneshot_opt_process(argv[0]);
 
+    if(options["lsp"])
+      return run_lsp();
+
+    if(options["daemon"])
+    {
+      // included files parsed by the runs are kept in the daemon for the next ones
+      g_include_cache=true;
+      return run_daemon(options["daemon"].argument, [&initial_options](int argc, char** argv) {
+        options=initial_options;
+        return lxsh_main(argc, argv);
+      }, dump_include_cache, load_include_cache);
+    }
+
+    if(options["batch"])
+    {
+      if(!optstop)
+        args=options.process(args);
+      get_opts(&g_ctx);
+      if(!options["outdir"])
+        throw option_value_error("--batch requires --outdir");
+      if(options['e'] || options['o'] || options['c'])
+        throw option_value_error("Incompatible options");
+      // each file is a new run in a child process
+      // included files parsed by a run are given to the next ones
+      g_include_cache=true;
+      return run_batch(args, options["outdir"].argument, g_jobs, [argv](std::string const& file, std::string const& out) {
+        options["batch"].activated=false;
+        std::vector<const char*> runargs = { argv[0], "-o", out.c_str(), "--", file.c_str() };
+        return lxsh_main(runargs.size(), (char**) runargs.data());
+      }, dump_include_cache, load_include_cache);
+    }
+
+    if(options["watch"])
+    {
+      if(!optstop)
+        args=options.process(args);
+      get_opts(&g_ctx);
+      if(!options['o'])
+        throw option_value_error("--watch requires -o");
+      if(options['e'] || options["batch"])
+        throw option_value_error("Incompatible options");
+      // runs are the same command without --watch
+      std::vector<char*> runargs;
+      for(int i=0; i<argc; i++)
+        if(strcmp(argv[i], "--watch") != 0)
+          runargs.push_back(argv[i]);
+      g_include_cache=true;
+      return run_watch([&]() {
+        options=initial_options;
+        opt_minify=false;
+        g_ctx.included.clear();
+        g_ctx.include_deps.clear();
+        g_ctx.dir="";
+        require_rescan_all();
+        return lxsh_main(runargs.size(), runargs.data());
+      }, []() {
+        std::vector<std::string> ret = g_ctx.included;
+        for(auto& it: g_ctx.include_deps)
+          ret.push_back(it.path);
+        return ret;
+      });
+    }
+
     // resolve input
     std::string file;
     if(args.size() > 0) // argument provided
@@ -134,16 +207,17 @@ int main(int argc, char* argv[])
         }
 
         oneshot_opt_process(argv[0]);
-        get_opts();
+        get_opts(&g_ctx);
 
       }
       // parse
-      if(!add_include(file))
+      if(!add_include(file, &g_ctx))
         continue;
 
       ctx.data=filecontents.data();
 
       ctx = make_context(filecontents, file, parse_bash);
+      ctx.run = &g_ctx;
       if(is_exec)
       {
         delete sh;
@@ -175,61 +249,24 @@ int main(int argc, char* argv[])
 
     // pre-listing modifiers
     if(options["remove-unused"])
-      delete_unused( sh, re_var_exclude, re_fct_exclude );
+      delete_unused( sh, g_ctx.re_var_exclude, g_ctx.re_fct_exclude );
 
     // list outputs
     if(options["list-var"])
-      list_vars(sh, re_var_exclude);
+      list_vars(sh, g_ctx.re_var_exclude);
     else if(options["list-var-def"])
-      list_var_defs(sh, re_var_exclude);
+      list_var_defs(sh, g_ctx.re_var_exclude);
     else if(options["list-var-call"])
-      list_var_calls(sh, re_var_exclude);
+      list_var_calls(sh, g_ctx.re_var_exclude);
     else if(options["list-fct"])
-      list_fcts(sh, re_fct_exclude);
+      list_fcts(sh, g_ctx.re_fct_exclude);
     else if(options["list-cmd"])
       list_cmds(sh, regex_null);
     // output
     else
     {
-      // post-listing modifiers
-      // implement commands
-      std::set<std::string> req_fcts;
-      if(shebang_is_bin && !options["no-extend"])
-        req_fcts = find_lxsh_commands(sh);
-      if(options["debashify"])
-        concat_sets(req_fcts, debashify(sh) );
-
-      add_lxsh_fcts(sh, req_fcts);
-
-      // processing before output
-      // minify
       strmap_t varmap, fctmap;
-      if(options['m'])
-      {
-        opt_minify=true;
-        minify_generic(sh);
-      }
-      if(options['A']) {
-        read_minmap(options['A'].argument, &varmap, &fctmap);
-        recurse(r_replace_var, sh, &varmap);
-        recurse(r_replace_fct, sh, &fctmap);
-      }
-      else if(options["minify-var"] && options["minify-fct"]) {
-        // optimization: get everything in one go
-        allmaps_get(sh, re_var_exclude, re_fct_exclude, regex_null);
-        varmap = minify_var( sh, re_var_exclude );
-        fctmap = minify_fct( sh, re_fct_exclude );
-      }
-      else if(options["minify-var"]) {
-        varmap = minify_var( sh, re_var_exclude );
-      }
-      else if(options["minify-fct"]) {
-        fctmap = minify_fct( sh, re_fct_exclude );
-      }
-      // other processing
-      if(options["unset-var"])
-        add_unset_variables( sh, re_var_exclude );
-
+      process_script(sh, shebang_is_bin, &g_ctx, &varmap, &fctmap);
 
       if(options['P']) {
         std::ofstream(options['P'].argument) << gen_minmap(varmap, "var") << gen_minmap(fctmap, "fct");
@@ -243,21 +280,35 @@ int main(int argc, char* argv[])
       else
   #endif
 
-      if(options['o']) // file output
       {
-        std::string destfile=options['o'];
-        // resolve - to stdout
-        if(destfile == "-")
-          destfile = "/dev/stdout";
-        // output
-        std::ofstream(destfile) << sh->generate(g_shebang, 0);
-        // don't chmod on /dev/
-        if(destfile.substr(0,5) != "/dev/")
-          ztd::exec("chmod", "+x", destfile);
-      }
-      else // to console
-      {
-        std::cout << sh->generate(g_shebang, 0);
+        std::string output;
+        if(options["compress"])
+        {
+          compress_report report;
+          bool do_report = options["compress-report"];
+          output = make_self_extract(sh->generate(false, 0), options["compress"].argument, g_shebang ? sh->shebang : "", do_report ? &report : nullptr);
+          if(do_report)
+            print_compress_report(report, options["compress"].argument);
+        }
+        else
+          output = sh->generate(g_shebang, 0);
+
+        if(options['o']) // file output
+        {
+          std::string destfile=options['o'];
+          // resolve - to stdout
+          if(destfile == "-")
+            destfile = "/dev/stdout";
+          // output
+          std::ofstream(destfile) << output;
+          // don't chmod on /dev/
+          if(destfile.substr(0,5) != "/dev/")
+            ztd::exec("chmod", "+x", destfile);
+        }
+        else // to console
+        {
+          std::cout << output;
+        }
       }
     }
   }
@@ -274,6 +325,13 @@ int main(int argc, char* argv[])
     std::cerr << e.what() << std::endl;
     return ERR_OPT;
   }
+  catch(option_value_error& e)
+  {
+    if(sh != nullptr)
+      delete sh;
+    std::cerr << e.what() << std::endl;
+    return ERR_OPT;
+  }
   catch(std::runtime_error& e)
   {
     if(tsh != nullptr)
@@ -287,3 +345,25 @@ int main(int argc, char* argv[])
 
   return ret;
 }
+
+int main(int argc, char* argv[])
+{
+  // forward to a daemon, unless starting one
+  const char* socket=getenv("LXSH_SOCKET");
+  if(socket != NULL && socket[0] != 0)
+  {
+    // options before the file, read the same way as lxsh_main
+    bool is_daemon=false;
+    try
+    {
+      ztd::option_set opts=options;
+      opts.process(argc, argv, {.stop_on_argument=true});
+      is_daemon=opts["daemon"];
+    }
+    catch(ztd::option_error& e) {}
+    int ret = is_daemon ? -1 : daemon_client(socket, argc, argv);
+    if(ret >= 0)
+      return ret;
+  }
+  return lxsh_main(argc, argv);
+}
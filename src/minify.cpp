@@ -1,11 +1,14 @@
 #include "minify.hpp"
 
 #include <fstream>
+#include <algorithm>
 
 #include "parse.hpp"
 #include "recursive.hpp"
 #include "processing.hpp"
+#include "optimize.hpp"
 #include "util.hpp"
+#include "struc_helper.hpp"
 
 std::vector<subarg_t*> cmd_t::subarg_vars()
 {
@@ -314,10 +317,10 @@ bool r_minify_useless_quotes(_obj* in)
     }; break;
     case _obj::redirect: {
       // for redirects: don't minify quotes on here documents
+      // nor on their delimitor: quotes disable expansion in the document
       redirect_t* t = dynamic_cast<redirect_t*>(in);
       if(t->here_document != nullptr)
       {
-        recurse(r_minify_useless_quotes, t->target);
         for(auto it: t->here_document->sa)
         {
           if(it->type!=_obj::subarg_string) {
@@ -392,6 +395,268 @@ strmap_t gen_minimal_map(countmap_t const& vars, set_t const& excluded)
   return ret;
 }
 
+/** SCOPES **/
+
+// variables local to a function: they can share names with locals of other functions
+struct var_scope {
+  function_t* fct;
+  // local variable -> occurences in the function
+  countmap_t vars;
+};
+
+bool r_has_function(_obj* in, bool* result)
+{
+  if(in->type == _obj::block_function)
+    *result = true;
+  return !*result;
+}
+
+bool r_get_functions(_obj* in, std::vector<function_t*>* fcts)
+{
+  if(in->type == _obj::block_function)
+  {
+    fcts->push_back(dynamic_cast<function_t*>(in));
+    // nested functions are ignored
+    return false;
+  }
+  return true;
+}
+
+// locals declared in the top-level of the function before any use
+var_scope get_var_scope(function_t* fct)
+{
+  var_scope ret;
+  ret.fct = fct;
+  countmap_t seen;
+  for(auto cl: fct->lst->cls)
+  {
+    block_t* bl = cl->first_block();
+    if(cl->pls.size() == 1 && cl->pls[0]->cmds.size() == 1 && bl != nullptr && bl->type == _obj::block_cmd && dynamic_cast<cmd_t*>(bl)->is("local"))
+    {
+      cmd_t* c = dynamic_cast<cmd_t*>(bl);
+      // local A=$A uses the caller's A
+      countmap_t used;
+      for(auto it: c->cmd_var_assigns)
+        if(it.second != nullptr)
+          recurse(r_get_var, it.second, &used, &used);
+      for(auto it: c->cmd_var_assigns)
+        if(it.first != nullptr && seen.find(it.first->varname) == seen.end() && used.find(it.first->varname) == used.end())
+          ret.vars[it.first->varname] = 0;
+    }
+    recurse(r_get_var, cl, &seen, &seen);
+  }
+  for(auto& it: ret.vars)
+    it.second = seen[it.first];
+  return ret;
+}
+
+// scopes of variables only ever used as locals
+std::vector<var_scope> get_var_scopes(_obj* in, countmap_t const& vars)
+{
+  std::vector<function_t*> fcts;
+  recurse(r_get_functions, in, &fcts);
+  std::vector<var_scope> ret;
+  countmap_t local_uses;
+  for(auto fct: fcts)
+  {
+    bool nested=false;
+    recurse(r_has_function, fct->lst, &nested);
+    if(nested || fct->lst == nullptr)
+      continue;
+    ret.push_back(get_var_scope(fct));
+    for(auto it: ret.back().vars)
+      local_uses[it.first] += it.second;
+  }
+  // used outside of functions declaring it local: leaks through dynamic scope
+  set_t leaking;
+  for(auto it: local_uses)
+  {
+    auto el = vars.find(it.first);
+    if(el == vars.end() || el->second != it.second)
+      leaking.insert(it.first);
+  }
+  for(auto& sc: ret)
+    for(auto it: leaking)
+      sc.vars.erase(it);
+  return ret;
+}
+
+struct scoped_varmap {
+  strmap_t* global;
+  std::map<function_t*, strmap_t> scopes;
+};
+
+bool r_replace_var_scoped(_obj* in, scoped_varmap* maps)
+{
+  if(in->type == _obj::block_function)
+  {
+    auto el = maps->scopes.find(dynamic_cast<function_t*>(in));
+    if(el != maps->scopes.end())
+    {
+      recurse(r_replace_var, in, &el->second);
+      return false;
+    }
+  }
+  return r_replace_var(in, maps->global);
+}
+
+/** STRINGS **/
+
+// minimal length of a string to be hoisted
+#define HOIST_MIN_SIZE 8
+
+// value of a static arg, false if it can expand
+bool get_literal_value(std::string const& raw, std::string* value)
+{
+  value->clear();
+  for(uint32_t i=0; i<raw.size(); i++)
+  {
+    if(raw[i] == '\'')
+    {
+      size_t j = raw.find('\'', i+1);
+      if(j == std::string::npos)
+        return false;
+      *value += raw.substr(i+1, j-i-1);
+      i = j;
+    }
+    else if(raw[i] == '"')
+    {
+      for(i++; i<raw.size() && raw[i] != '"'; i++)
+      {
+        if(raw[i] == '$' || raw[i] == '`')
+          return false;
+        if(raw[i] == '\\' && i+1 < raw.size() && is_in(raw[i+1], "$`\"\\\n"))
+        {
+          i++;
+          if(raw[i] == '\n')
+            continue;
+        }
+        *value += raw[i];
+      }
+      if(i >= raw.size())
+        return false;
+    }
+    else if(raw[i] == '\\' && i+1 < raw.size())
+    {
+      i++;
+      if(raw[i] != '\n')
+        *value += raw[i];
+    }
+    // unquoted chars that could expand
+    else if(!is_alphanum(raw[i]) && !is_in(raw[i], "_./:,+@%-="))
+      return false;
+    else
+      *value += raw[i];
+  }
+  return true;
+}
+
+struct hoist_literal {
+  std::string value;
+  std::vector<arg_t*> args;
+  // current size of all occurences
+  size_t size=0;
+};
+
+typedef std::map<std::string, hoist_literal> literalmap_t;
+
+void add_hoist_literal(arg_t* in, literalmap_t* literals)
+{
+  std::string value;
+  if(in == nullptr || !in->is_string() || !get_literal_value(in->string(), &value) || value.size() < HOIST_MIN_SIZE)
+    return;
+  hoist_literal& lit = (*literals)[value];
+  lit.value = value;
+  lit.args.push_back(in);
+  lit.size += in->string().size();
+}
+
+bool r_get_hoist_literals(_obj* in, literalmap_t* literals)
+{
+  switch(in->type)
+  {
+    case _obj::block_cmd: {
+      cmd_t* t = dynamic_cast<cmd_t*>(in);
+      // [[ ]] patterns and regexes depend on quoting
+      if(t->is_cmdvar || t->arglist_size() < 2 || t->arg_string(0) == "[[")
+        break;
+      for(uint32_t i=1; i<t->args->args.size(); i++)
+        add_hoist_literal(t->args->args[i], literals);
+    }; break;
+    case _obj::block_for: {
+      for_t* t = dynamic_cast<for_t*>(in);
+      if(t->iter != nullptr)
+        for(auto it: t->iter->args)
+          add_hoist_literal(it, literals);
+    }; break;
+    case _obj::redirect: {
+      redirect_t* t = dynamic_cast<redirect_t*>(in);
+      if(t->here_document == nullptr)
+        add_hoist_literal(t->target, literals);
+    }; break;
+    default: break;
+  }
+  return true;
+}
+
+// replace strings repeated in args with a variable defined at the start of the script
+// only done when it saves space: the definition has to cost less than the replaced strings
+void minify_strings(shmain* sh, std::regex const& exclude)
+{
+  literalmap_t literals;
+  recurse(r_get_hoist_literals, sh, &literals);
+
+  // names can't collide with any variable
+  varmap_get(sh, regex_null);
+  set_t excluded = map_to_set(m_vars);
+  concat_sets(excluded, m_excluded_var);
+  concat_sets(excluded, all_reserved_words);
+  // unquoted expansion relies on the default IFS
+  bool ifs_set = m_vardefs.find("IFS") != m_vardefs.end();
+
+  std::vector<hoist_literal*> ordered;
+  for(auto& it: literals)
+    if(it.second.args.size() > 1)
+      ordered.push_back(&it.second);
+  std::sort(ordered.begin(), ordered.end(), [](hoist_literal* a, hoist_literal* b) { return a->size > b->size; });
+
+  cmd_t* defs = new cmd_t;
+  uint32_t n=0;
+  for(auto lit: ordered)
+  {
+    std::string name;
+    uint32_t tn = n;
+    do {
+      name = minimal_name(tn++);
+    } while( excluded.find(name) != excluded.end() || std::regex_match(name, exclude) );
+
+    bool quote = ifs_set || lit->value.find_first_of(" \t\n*?[") != std::string::npos;
+    size_t expansion_size = name.size() + (quote ? 3 : 1);
+    std::string definition = single_quote(lit->value);
+    // NAME=VALUE and a separator
+    size_t cost = lit->args.size()*expansion_size + name.size() + 1 + definition.size() + 1;
+    if(cost >= lit->size)
+      continue;
+
+    n = tn;
+    defs->var_assigns.push_back(std::make_pair(new variable_t(name, nullptr, true), new arg_t("="+definition)));
+    for(auto it: lit->args)
+    {
+      arg_t* t = quote ? make_quoted_var(name) : new arg_t(new subarg_variable_t(new variable_t(name)));
+      std::swap(it->sa, t->sa);
+      delete t;
+    }
+  }
+
+  if(defs->var_assigns.size() > 0)
+  {
+    sh->lst->cls.insert(sh->lst->cls.begin(), new condlist_t(defs));
+    require_rescan_var();
+  }
+  else
+    delete defs;
+}
+
 // calls
 
 strmap_t minify_var(_obj* in, std::regex const& exclude)
@@ -404,10 +669,42 @@ strmap_t minify_var(_obj* in, std::regex const& exclude)
   // concatenate excluded and reserved
   concat_sets(excluded, m_excluded_var);
   concat_sets(excluded, all_reserved_words);
+  // locals of different functions share names, like registers:
+  // the n-th most used local of each function goes in the same slot
+  std::vector<var_scope> scopes = get_var_scopes(in, m_vars);
+  countmap_t vars = m_vars;
+  std::vector<std::vector<std::pair<std::string,uint32_t>>> ranks;
+  for(auto& sc: scopes)
+  {
+    ranks.push_back(sort_by_value(sc.vars));
+    for(uint32_t i=0; i<ranks.back().size(); i++)
+    {
+      vars.erase(ranks.back()[i].first);
+      vars[std::string("\1")+std::to_string(i)] += ranks.back()[i].second;
+    }
+  }
   // create mapping
-  varmap=gen_minimal_map(m_vars, excluded);
+  varmap=gen_minimal_map(vars, excluded);
+  scoped_varmap maps;
+  maps.global = &varmap;
+  for(uint32_t i=0; i<scopes.size(); i++)
+  {
+    if(ranks[i].size() <= 0)
+      continue;
+    strmap_t& scmap = maps.scopes[scopes[i].fct];
+    scmap = varmap;
+    for(uint32_t j=0; j<ranks[i].size(); j++)
+      scmap[ranks[i][j].first] = varmap[std::string("\1")+std::to_string(j)];
+  }
+  for(auto it=varmap.begin(); it!=varmap.end(); )
+  {
+    if(it->first[0] == '\1')
+      it = varmap.erase(it);
+    else
+      it++;
+  }
   // perform replace
-  recurse(r_replace_var, in, &varmap);
+  recurse(r_replace_var_scoped, in, &maps);
   require_rescan_var();
   return varmap;
 }
@@ -551,7 +848,7 @@ bool r_minify_empty_manip(_obj* in)
   return true;
 }
 
-pipeline_t* do_one_minify_single_block(block_t* in)
+pipeline_t* do_one_minify_single_block(block_t* in, countmap_t* fcts)
 {
   pipeline_t* ret=nullptr;
   list_t* l=nullptr;
@@ -570,7 +867,7 @@ pipeline_t* do_one_minify_single_block(block_t* in)
   ret = l->cls[0]->pls[0];
 
   // if is a subshell and has some env set: don't remove it
-  if(in->type == _obj::block_subshell && has_env_set(ret))
+  if(in->type == _obj::block_subshell && has_env_set(ret, fcts))
     return nullptr;
 
   // has a non-stdout/stdin redirect: not applicable
@@ -582,7 +879,7 @@ pipeline_t* do_one_minify_single_block(block_t* in)
   return ret;
 }
 
-bool r_minify_single_block(_obj* in)
+bool r_minify_single_block(_obj* in, countmap_t* fcts)
 {
   switch(in->type)
   {
@@ -596,7 +893,7 @@ bool r_minify_single_block(_obj* in)
         pipeline_t* t = dynamic_cast<pipeline_t*>(in);
         for(uint32_t i=0; i<t->cmds.size(); i++)
         {
-          pipeline_t* ret = do_one_minify_single_block(t->cmds[i]);
+          pipeline_t* ret = do_one_minify_single_block(t->cmds[i], fcts);
           if(ret != nullptr) {
             // concatenate redirects
             block_t* firstb = ret->cmds[0];
@@ -683,17 +980,21 @@ bool r_minify_backtick(_obj* in)
 }
 
 // optimisation for processors that don't have recurse-cancellation
-bool r_minify(_obj* in)
+bool r_minify(_obj* in, countmap_t* fcts, run_context* run)
 {
   r_minify_empty_manip(in);
-  r_minify_single_block(in);
-  r_do_string_processor(in);
+  r_minify_single_block(in, fcts);
+  r_do_string_processor(in, run);
   return true;
 }
 
-void minify_generic(_obj* in)
+void minify_generic(_obj* in, run_context* run)
 {
-  recurse(r_minify, in);
+  countmap_t fcts;
+  recurse(r_get_fct, in, &fcts);
+  recurse(r_minify, in, &fcts, run);
+  uint32_t folded=0;
+  recurse(r_fold_arithmetic, in, &folded);
   recurse(r_minify_backtick, in);
   recurse(r_minify_useless_quotes, in);
 }
@@ -0,0 +1,1157 @@
+#include "optimize.hpp"
+
+#include <iostream>
+#include <functional>
+#include <map>
+
+#include <errno.h>
+#include <stdlib.h>
+
+#include "recursive.hpp"
+#include "struc_helper.hpp"
+#include "options.hpp"
+#include "util.hpp"
+#include "parse.hpp"
+
+// strip trailing newlines of VAR, as done by command substitution
+#define STRIP_NEWLINES(var) "${" var "%\"${" var "##*[!\n]}\"}"
+
+/** TOOLS **/
+
+// VAR if arg is exactly "$VAR"
+variable_t* get_quoted_var(arg_t* in)
+{
+  if(in == nullptr || in->sa.size() != 3 || in->sa[1]->type != _obj::subarg_variable)
+    return nullptr;
+  if(in->sa[0]->type != _obj::subarg_string || dynamic_cast<subarg_string_t*>(in->sa[0])->val != "\"")
+    return nullptr;
+  if(in->sa[2]->type != _obj::subarg_string || dynamic_cast<subarg_string_t*>(in->sa[2])->val != "\"")
+    return nullptr;
+  variable_t* v = dynamic_cast<subarg_variable_t*>(in->sa[1])->var;
+  if(v->is_manip || v->index != nullptr || !is_varname(v->varname))
+    return nullptr;
+  return v;
+}
+
+// VAR if arg is exactly $VAR or "$VAR"
+variable_t* get_var(arg_t* in)
+{
+  if(in != nullptr && in->sa.size() == 1 && in->sa[0]->type == _obj::subarg_variable)
+  {
+    variable_t* v = dynamic_cast<subarg_variable_t*>(in->sa[0])->var;
+    if(!v->is_manip && v->index == nullptr && is_varname(v->varname))
+      return v;
+    return nullptr;
+  }
+  return get_quoted_var(in);
+}
+
+// string that doesn't need quoting and can't expand
+bool is_plain_string(arg_t* in)
+{
+  if(in == nullptr || !in->is_string())
+    return false;
+  std::string const& str = in->string();
+  for(auto c: str)
+    if(!is_alphanum(c) && !is_in(c, "_./:=,+@%-"))
+      return false;
+  return true;
+}
+
+bool is_int_string(std::string const& in)
+{
+  uint32_t i = (in.size() > 0 && in[0] == '-') ? 1 : 0;
+  if(i >= in.size())
+    return false;
+  for(; i<in.size(); i++)
+    if(!is_num(in[i]))
+      return false;
+  return true;
+}
+
+// integer read the same way by expr and $(( )): no leading 0, which is octal in arithmetic
+bool is_decimal_string(std::string const& in)
+{
+  if(!is_int_string(in))
+    return false;
+  uint32_t i = in[0] == '-' ? 1 : 0;
+  return in[i] != '0' || in.size() == i+1;
+}
+
+std::string strip_trailing(std::string in, char c)
+{
+  while(in.size() > 0 && in.back() == c)
+    in.pop_back();
+  return in;
+}
+
+// POSIX basename and dirname
+std::string posix_basename(std::string const& in)
+{
+  if(in == "")
+    return "";
+  std::string t = strip_trailing(in, '/');
+  if(t == "")
+    return "/";
+  return t.substr(t.rfind('/')+1);
+}
+
+std::string posix_dirname(std::string const& in)
+{
+  std::string t = strip_trailing(in, '/');
+  if(t == "")
+    return in == "" ? "." : "/";
+  size_t i = t.rfind('/');
+  if(i == std::string::npos)
+    return ".";
+  t = strip_trailing(t.substr(0, i), '/');
+  return t == "" ? "/" : t;
+}
+
+// the single simple command of a command substitution
+cmd_t* get_cmdsubst_cmd(subshell_t* in)
+{
+  if(in == nullptr || in->lst == nullptr || in->redirs.size() > 0)
+    return nullptr;
+  cmd_t* c = in->single_cmd();
+  if(c == nullptr || in->lst->cls[0]->parallel || in->lst->cls[0]->pls[0]->negated || in->lst->cls[0]->pls[0]->bash_time)
+    return nullptr;
+  if(c->redirs.size() > 0 || c->var_assigns.size() > 0)
+    return nullptr;
+  return c;
+}
+
+// arithmetic operand of expr: decimal constants only,
+// the value of a variable could have leading zeros and be read as octal
+arithmetic_t* make_expr_operand(arg_t* in)
+{
+  if(in->is_string() && is_decimal_string(in->string()))
+    return new arithmetic_number_t(in->string());
+  return nullptr;
+}
+
+// cmd_t of a pipeline element, nullptr if it isn't a bare command or is redefined by a function
+cmd_t* get_bare_cmd(block_t* in, countmap_t* fcts)
+{
+  if(in->type != _obj::block_cmd || in->redirs.size() > 0)
+    return nullptr;
+  cmd_t* c = dynamic_cast<cmd_t*>(in);
+  if(c->var_assigns.size() > 0 || c->is_cmdvar || c->arglist_size() < 1)
+    return nullptr;
+  if(fcts->find(c->arg_string(0)) != fcts->end())
+    return nullptr;
+  return c;
+}
+
+// block has a redirect of its stdin
+bool has_stdin_redirect(block_t* in)
+{
+  for(auto it: in->redirs)
+    if(it->op.find('<') != std::string::npos || (it->op.size() > 0 && it->op[0] == '0'))
+      return true;
+  return false;
+}
+
+// condlist already has a here document
+bool has_here_document(condlist_t* in)
+{
+  for(auto pl: in->pls)
+    for(auto bl: pl->cmds)
+      for(auto it: bl->redirs)
+        if(it->here_document != nullptr)
+          return true;
+  return false;
+}
+
+// the file of a cat/grep: plain string or "$VAR"
+bool is_file_arg(arg_t* in)
+{
+  return (is_plain_string(in) && in->string()[0] != '-') || get_quoted_var(in) != nullptr;
+}
+
+// here document with the output of echo/printf, nullptr if not applicable
+// echo STR...          -> <<EOF STR... EOF
+// printf '%s\n' "$VAR" -> <<EOF $VAR EOF
+redirect_t* make_output_heredoc(cmd_t* in)
+{
+  std::string const& cmdstr = in->arg_string(0);
+  std::vector<arg_t*>& args = in->args->args;
+  arg_t* doc = nullptr;
+  std::string delimitor = "EOF";
+  if(cmdstr == "echo")
+  {
+    std::string str;
+    for(uint32_t i=1; i<args.size(); i++)
+    {
+      if(!is_plain_string(args[i]) || (i == 1 && args[i]->string()[0] == '-'))
+        return nullptr;
+      if(i > 1)
+        str += ' ';
+      str += args[i]->string();
+    }
+    if(str == delimitor)
+      delimitor += '_';
+    doc = new arg_t(str + '\n' + delimitor);
+  }
+  else if(cmdstr == "printf" && args.size() == 3 && is_in_vector(args[1]->generate(0), {"'%s\\n'", "\"%s\\n\""}))
+  {
+    variable_t* v = get_quoted_var(args[2]);
+    if(v == nullptr)
+      return nullptr;
+    doc = new arg_t;
+    doc->add(new subarg_variable_t(new variable_t(v->varname)));
+    doc->add(new subarg_string_t('\n' + delimitor));
+  }
+  else
+    return nullptr;
+  return new redirect_t("<<", new arg_t(delimitor), doc);
+}
+
+// grep reading its input with only simple options and a pattern that can't be invalid:
+// with -F, or static without brackets, groups or escapes
+bool is_countable_grep(cmd_t* in)
+{
+  if(in->arg_string(0) != "grep")
+    return false;
+  std::vector<arg_t*>& args = in->args->args;
+  bool fixed=false;
+  uint32_t i=1;
+  for(; i<args.size() && args[i]->is_string() && args[i]->string()[0] == '-'; i++)
+  {
+    std::string const& str = args[i]->string();
+    if(str.size() < 2 || str.find_first_not_of("ivEFwx", 1) != std::string::npos)
+      return false;
+    if(str.find('F') != std::string::npos)
+      fixed=true;
+  }
+  // a file could be missing
+  if(i+1 != args.size())
+    return false;
+  if(args[i]->is_string())
+    return fixed || args[i]->string().find_first_of("[\\({") == std::string::npos;
+  return fixed && get_quoted_var(args[i]) != nullptr;
+}
+
+/** ARITHMETIC **/
+
+// binary operator precedence: higher binds tighter
+int arithmetic_precedence(std::string const& op)
+{
+  static const std::map<std::string, int> precedences = {
+    {"*", 10}, {"/", 10}, {"%", 10},
+    {"+", 9}, {"-", 9},
+    {"<<", 8}, {">>", 8},
+    {"==", 6}, {"!=", 6},
+    {"&", 5},
+    {"^", 4},
+    {"|", 3},
+    {"&&", 2},
+    {"||", 1},
+    {"=", 0}, {"+=", 0}, {"-=", 0}, {"*=", 0}, {"/=", 0},
+  };
+  auto it = precedences.find(op);
+  if(it == precedences.end())
+    return -1;
+  return it->second;
+}
+
+bool is_arithmetic_assign(std::string const& op)
+{
+  return arithmetic_precedence(op) == 0;
+}
+
+arithmetic_operation_t* get_binary_operation(arithmetic_t* in)
+{
+  if(in->type != _obj::arithmetic_operation || dynamic_cast<arithmetic_operation_t*>(in)->precedence)
+    return nullptr;
+  return dynamic_cast<arithmetic_operation_t*>(in);
+}
+
+arithmetic_operation_t* get_prefix_operation(arithmetic_t* in)
+{
+  if(in->type != _obj::arithmetic_operation || !dynamic_cast<arithmetic_operation_t*>(in)->precedence)
+    return nullptr;
+  return dynamic_cast<arithmetic_operation_t*>(in);
+}
+
+// value of a number, false if not a valid shell integer
+bool get_arithmetic_number(arithmetic_t* in, int64_t* val)
+{
+  if(in->type != _obj::arithmetic_number)
+    return false;
+  std::string const& str = dynamic_cast<arithmetic_number_t*>(in)->val;
+  if(!is_int_string(str))
+    return false;
+  bool neg = str[0] == '-';
+  std::string digits = str.substr(neg ? 1 : 0);
+  // leading 0 is octal
+  int base = (digits.size() > 1 && digits[0] == '0') ? 8 : 10;
+  if(base == 8 && digits.find_first_of("89") != std::string::npos)
+    return false;
+  errno = 0;
+  char* end;
+  long long r = strtoll(str.c_str(), &end, base);
+  if(errno != 0 || *end != 0)
+    return false;
+  *val = r;
+  return true;
+}
+
+// operand is expanded as text before evaluation: $1, ${VAR}, $(CMD)
+// operator precedence around it can't be known
+bool is_textual_operand(arithmetic_t* in)
+{
+  switch(in->type)
+  {
+    case _obj::arithmetic_subshell: return true;
+    case _obj::arithmetic_variable: return in->generate(0)[0] == '$';
+    case _obj::arithmetic_operation: {
+      arithmetic_operation_t* t = dynamic_cast<arithmetic_operation_t*>(in);
+      return is_textual_operand(t->val1) || (t->val2 != nullptr && is_textual_operand(t->val2));
+    }
+    default: return false;
+  }
+}
+
+// evaluate with shell integer semantics, false if not applicable or error
+bool eval_arithmetic_operation(std::string const& op, int64_t a, int64_t b, int64_t* r)
+{
+  if(op == "+")       return !__builtin_add_overflow(a, b, r);
+  else if(op == "-")  return !__builtin_sub_overflow(a, b, r);
+  else if(op == "*")  return !__builtin_mul_overflow(a, b, r);
+  else if(op == "/" || op == "%")
+  {
+    // leave errors to the shell
+    if(b == 0 || (a == INT64_MIN && b == -1))
+      return false;
+    *r = op == "/" ? a / b : a % b;
+  }
+  else if(op == "<<" || op == ">>")
+  {
+    if(a < 0 || b < 0 || b >= 63)
+      return false;
+    *r = op == "<<" ? a << b : a >> b;
+    if(op == "<<" && (*r >> b) != a)
+      return false;
+  }
+  else if(op == "==") *r = a == b;
+  else if(op == "!=") *r = a != b;
+  else if(op == "&")  *r = a & b;
+  else if(op == "^")  *r = a ^ b;
+  else if(op == "|")  *r = a | b;
+  else if(op == "&&") *r = a && b;
+  else if(op == "||") *r = a || b;
+  else
+    return false;
+  return *r != INT64_MIN;
+}
+
+bool eval_arithmetic_prefix(std::string const& op, int64_t a, int64_t* r)
+{
+  if(op == "-")       *r = -a;
+  else if(op == "+")  *r = a;
+  else if(op == "!")  *r = !a;
+  else if(op == "~")  *r = ~a;
+  else
+    return false;
+  return a != INT64_MIN;
+}
+
+// take ownership of one side of an operation and delete the rest
+arithmetic_t* extract_operand(arithmetic_operation_t* in, bool first)
+{
+  arithmetic_t* ret = first ? in->val1 : in->val2;
+  (first ? in->val1 : in->val2) = nullptr;
+  delete in;
+  return ret;
+}
+
+// fold constant operations and identities of a precedence-correct tree
+arithmetic_t* fold_arithmetic_tree(arithmetic_t* in, uint32_t* count)
+{
+  if(in->type != _obj::arithmetic_operation)
+    return in;
+  arithmetic_operation_t* t = dynamic_cast<arithmetic_operation_t*>(in);
+  int64_t a, b, r;
+  t->val1 = fold_arithmetic_tree(t->val1, count);
+  if(t->precedence)
+  {
+    if(get_arithmetic_number(t->val1, &a) && eval_arithmetic_prefix(t->oper, a, &r))
+    {
+      delete t;
+      (*count)++;
+      return new arithmetic_number_t(std::to_string(r));
+    }
+    return t;
+  }
+  t->val2 = fold_arithmetic_tree(t->val2, count);
+  if(is_arithmetic_assign(t->oper))
+    return t;
+  bool num1 = get_arithmetic_number(t->val1, &a);
+  bool num2 = get_arithmetic_number(t->val2, &b);
+  if(num1 && num2 && eval_arithmetic_operation(t->oper, a, b, &r))
+  {
+    delete t;
+    (*count)++;
+    return new arithmetic_number_t(std::to_string(r));
+  }
+  // identities: X+0 X-0 X*1 X/1 X|0 X^0 X<<0 X>>0 and the commutative ones
+  if(num2 && ( (b == 0 && is_in_vector(t->oper, {"+", "-", "|", "^", "<<", ">>"})) || (b == 1 && is_in_vector(t->oper, {"*", "/"})) ) )
+  {
+    (*count)++;
+    return extract_operand(t, true);
+  }
+  if(num1 && ( (a == 0 && is_in_vector(t->oper, {"+", "|", "^"})) || (a == 1 && t->oper == "*") ) )
+  {
+    (*count)++;
+    return extract_operand(t, false);
+  }
+  return t;
+}
+
+bool is_negative_number(arithmetic_t* in)
+{
+  return in->type == _obj::arithmetic_number && dynamic_cast<arithmetic_number_t*>(in)->val[0] == '-';
+}
+
+// add parentheses needed for the generated text to keep the tree's precedence
+arithmetic_t* parenthesize_arithmetic_tree(arithmetic_t* in)
+{
+  arithmetic_operation_t* t = dynamic_cast<arithmetic_operation_t*>(in);
+  if(t == nullptr)
+    return in;
+  t->val1 = parenthesize_arithmetic_tree(t->val1);
+  if(t->precedence)
+  {
+    // also prevents '- -' from becoming '--'
+    if(get_binary_operation(t->val1) != nullptr || get_prefix_operation(t->val1) != nullptr || is_negative_number(t->val1))
+      t->val1 = new arithmetic_parenthesis_t(t->val1);
+    return t;
+  }
+  t->val2 = parenthesize_arithmetic_tree(t->val2);
+  int prec = arithmetic_precedence(t->oper);
+  arithmetic_operation_t* op1 = get_binary_operation(t->val1);
+  arithmetic_operation_t* op2 = get_binary_operation(t->val2);
+  if(op1 != nullptr && arithmetic_precedence(op1->oper) < prec)
+    t->val1 = new arithmetic_parenthesis_t(t->val1);
+  if(op2 != nullptr && (arithmetic_precedence(op2->oper) < prec || (arithmetic_precedence(op2->oper) == prec && !is_arithmetic_assign(t->oper))))
+    t->val2 = new arithmetic_parenthesis_t(t->val2);
+  else if((get_prefix_operation(t->val2) != nullptr || is_negative_number(t->val2)) && is_in(t->oper.back(), "+-"))
+    t->val2 = new arithmetic_parenthesis_t(t->val2);
+  return t;
+}
+
+// operands and operators of an expression, in generated order
+struct arithmetic_chain {
+  std::vector<arithmetic_t*> operands;
+  std::vector<std::string> opers;
+};
+
+arithmetic_t* fold_arithmetic(arithmetic_t* in, uint32_t* count);
+
+// the parser builds right-recursive trees without precedence: unpack them
+void get_arithmetic_chain(arithmetic_t* in, arithmetic_chain* chain, std::vector<arithmetic_operation_t*>& prefixes, uint32_t* count)
+{
+  arithmetic_operation_t* t = dynamic_cast<arithmetic_operation_t*>(in);
+  if(t != nullptr && t->precedence)
+  {
+    // prefix applies to the next operand only
+    arithmetic_t* val = t->val1;
+    t->val1 = nullptr;
+    prefixes.push_back(t);
+    get_arithmetic_chain(val, chain, prefixes, count);
+    return;
+  }
+  arithmetic_t* operand = in;
+  arithmetic_t* next = nullptr;
+  if(t != nullptr)
+  {
+    operand = t->val1;
+    next = t->val2;
+    chain->opers.push_back(t->oper);
+    t->val1 = t->val2 = nullptr;
+    delete t;
+  }
+  if(operand->type == _obj::arithmetic_parenthesis)
+  {
+    arithmetic_parenthesis_t* p = dynamic_cast<arithmetic_parenthesis_t*>(operand);
+    p->val = fold_arithmetic(p->val, count);
+  }
+  for(auto it=prefixes.rbegin(); it!=prefixes.rend(); it++)
+  {
+    (*it)->val1 = operand;
+    operand = *it;
+  }
+  prefixes.clear();
+  chain->operands.push_back(operand);
+  if(next != nullptr)
+    get_arithmetic_chain(next, chain, prefixes, count);
+}
+
+// remove a parenthesis that isn't needed for text expansion, to be re-added where needed
+arithmetic_t* unwrap_parenthesis(arithmetic_t* in, bool textual_chain, uint32_t* count)
+{
+  arithmetic_operation_t* t = get_prefix_operation(in);
+  if(t != nullptr)
+  {
+    t->val1 = unwrap_parenthesis(t->val1, textual_chain, count);
+    return t;
+  }
+  if(in->type != _obj::arithmetic_parenthesis)
+    return in;
+  arithmetic_parenthesis_t* p = dynamic_cast<arithmetic_parenthesis_t*>(in);
+  bool single = p->val->type == _obj::arithmetic_number ? !is_negative_number(p->val) : p->val->type == _obj::arithmetic_variable && !is_textual_operand(p->val);
+  if( (textual_chain && !single) || is_textual_operand(p->val) )
+    return in;
+  arithmetic_t* ret = p->val;
+  p->val = nullptr;
+  delete p;
+  if(single)
+    (*count)++;
+  return ret;
+}
+
+// fold constants of an arithmetic expression, respecting shell operator precedence
+arithmetic_t* fold_arithmetic(arithmetic_t* in, uint32_t* count)
+{
+  if(in == nullptr)
+    return in;
+  arithmetic_chain chain;
+  std::vector<arithmetic_operation_t*> prefixes;
+  get_arithmetic_chain(in, &chain, prefixes, count);
+
+  bool textual = false;
+  for(auto it: chain.operands)
+    textual |= is_textual_operand(it);
+  for(auto& it: chain.operands)
+    it = unwrap_parenthesis(it, textual, count);
+
+  if(textual)
+  {
+    // keep the original structure
+    arithmetic_t* ret = chain.operands.back();
+    for(uint32_t i=chain.opers.size(); i>0; i--)
+      ret = new arithmetic_operation_t(chain.opers[i-1], chain.operands[i-1], ret);
+    return ret;
+  }
+
+  // precedence climbing
+  uint32_t i=0;
+  std::function<arithmetic_t*(int)> build = [&](int min) -> arithmetic_t* {
+    arithmetic_t* lhs = chain.operands[i];
+    while(i < chain.opers.size() && arithmetic_precedence(chain.opers[i]) >= min)
+    {
+      std::string op = chain.opers[i];
+      int prec = arithmetic_precedence(op);
+      i++;
+      arithmetic_t* rhs = build(is_arithmetic_assign(op) ? prec : prec+1);
+      lhs = new arithmetic_operation_t(op, lhs, rhs);
+    }
+    return lhs;
+  };
+  arithmetic_t* ret = build(0);
+  ret = fold_arithmetic_tree(ret, count);
+  return parenthesize_arithmetic_tree(ret);
+}
+
+bool r_fold_arithmetic(_obj* in, uint32_t* count)
+{
+  switch(in->type)
+  {
+    case _obj::subarg_arithmetic: {
+      subarg_arithmetic_t* t = dynamic_cast<subarg_arithmetic_t*>(in);
+      t->arith = fold_arithmetic(t->arith, count);
+    }; break;
+    default: break;
+  }
+  return true;
+}
+
+/** INLINE **/
+
+// inline functions called more than once only if small
+#define INLINE_MAX_SIZE 64
+#define INLINE_MAX_GROWTH 256
+
+// commands that behave differently inside a function
+const std::set<std::string> inline_excluded_cmds = {
+  "return", "local", "declare", "typeset", "shift", "set", "getopts", "break", "continue", "eval", "caller"
+};
+
+struct inline_check {
+  bool ok=true;
+  // positional parameters used as "$N" or $N
+  std::set<uint32_t> simple_positionals;
+  // positional parameters used in manipulations or arithmetic
+  std::set<uint32_t> complex_positionals;
+};
+
+bool is_positional(std::string const& in)
+{
+  return in.size() > 0 && in != "0" && in.find_first_not_of("0123456789") == std::string::npos;
+}
+
+bool r_inline_check(_obj* in, inline_check* chk)
+{
+  if(!chk->ok)
+    return false;
+  switch(in->type)
+  {
+    case _obj::block_function: chk->ok = false; break;
+    case _obj::block_cmd: {
+      cmd_t* t = dynamic_cast<cmd_t*>(in);
+      if(t->arglist_size() > 0 && (t->arg_string(0) == "" || inline_excluded_cmds.find(t->arg_string(0)) != inline_excluded_cmds.end()))
+        chk->ok = false;
+    }; break;
+    case _obj::subarg_variable: {
+      variable_t* v = dynamic_cast<subarg_variable_t*>(in)->var;
+      if(!v->is_manip && v->index == nullptr && is_positional(v->varname))
+      {
+        chk->simple_positionals.insert(std::stoi(v->varname));
+        return false;
+      }
+    }; break;
+    case _obj::variable: {
+      variable_t* t = dynamic_cast<variable_t*>(in);
+      if( (t->varname.size() == 1 && is_in(t->varname[0], "@*#")) || t->varname == "FUNCNAME")
+        chk->ok = false;
+      else if(is_positional(t->varname))
+        chk->complex_positionals.insert(std::stoi(t->varname));
+    }; break;
+    default: break;
+  }
+  return chk->ok;
+}
+
+// replace positional parameters with call arguments
+bool r_inline_positionals(_obj* in, std::vector<arg_t*>* args)
+{
+  switch(in->type)
+  {
+    case _obj::arg: {
+      arg_t* t = dynamic_cast<arg_t*>(in);
+      for(uint32_t i=0; i<t->sa.size(); i++)
+      {
+        if(t->sa[i]->type != _obj::subarg_variable)
+          continue;
+        variable_t* v = dynamic_cast<subarg_variable_t*>(t->sa[i])->var;
+        if(v->is_manip || v->index != nullptr || !is_positional(v->varname))
+          continue;
+        arg_t* val = (*args)[std::stoi(v->varname)];
+        if(val->is_string())
+        {
+          delete t->sa[i];
+          t->sa[i] = new subarg_string_t(val->string());
+        }
+      }
+    }; break;
+    case _obj::variable: {
+      variable_t* t = dynamic_cast<variable_t*>(in);
+      if(is_positional(t->varname))
+        t->varname = get_quoted_var((*args)[std::stoi(t->varname)])->varname;
+    }; break;
+    default: break;
+  }
+  return true;
+}
+
+// call arguments can replace the positional parameters of the function
+bool can_inline_call(cmd_t* in, inline_check* chk, bool body_sets_env)
+{
+  if(in->var_assigns.size() > 0 || in->is_cmdvar)
+    return false;
+  std::vector<arg_t*>& args = in->args->args;
+  // arguments must have no side effect
+  for(uint32_t i=1; i<args.size(); i++)
+    if(!is_plain_string(args[i]) && get_quoted_var(args[i]) == nullptr)
+      return false;
+  for(auto n: chk->simple_positionals)
+  {
+    if(n >= args.size() || (!args[n]->is_string() && body_sets_env))
+      return false;
+  }
+  for(auto n: chk->complex_positionals)
+  {
+    // only a variable can be used in manipulations, and must not change
+    if(n >= args.size() || args[n]->is_string() || body_sets_env)
+      return false;
+  }
+  return true;
+}
+
+struct inline_calls {
+  std::string name;
+  std::vector<std::pair<pipeline_t*, uint32_t>> calls;
+};
+
+bool r_get_inline_calls(_obj* in, inline_calls* calls)
+{
+  switch(in->type)
+  {
+    case _obj::pipeline: {
+      pipeline_t* t = dynamic_cast<pipeline_t*>(in);
+      for(uint32_t i=0; i<t->cmds.size(); i++)
+      {
+        if(t->cmds[i]->type == _obj::block_cmd && dynamic_cast<cmd_t*>(t->cmds[i])->arg_string(0) == calls->name)
+          calls->calls.push_back(std::make_pair(t, i));
+      }
+    }; break;
+    default: break;
+  }
+  return true;
+}
+
+// count the occurences of a word in strings of the script: detects dynamic calls
+bool r_count_word(_obj* in, std::pair<std::string, uint32_t>* word)
+{
+  switch(in->type)
+  {
+    case _obj::subarg_string: {
+      std::string const& str = dynamic_cast<subarg_string_t*>(in)->val;
+      std::string const& w = word->first;
+      for(size_t i=str.find(w); i!=std::string::npos; i=str.find(w, i+1))
+      {
+        if( (i == 0 || !(is_alphanum(str[i-1]) || str[i-1] == '_')) &&
+            (i+w.size() >= str.size() || !(is_alphanum(str[i+w.size()]) || str[i+w.size()] == '_')) )
+          word->second++;
+      }
+    }; break;
+    default: break;
+  }
+  return true;
+}
+
+bool r_has_dynamic_cmd(_obj* in, bool* result)
+{
+  switch(in->type)
+  {
+    case _obj::block_cmd: {
+      cmd_t* t = dynamic_cast<cmd_t*>(in);
+      if(t->arglist_size() > 0 && t->arg_string(0) == "")
+        *result = true;
+    }; break;
+    default: break;
+  }
+  return !*result;
+}
+
+// try to inline the function defined by the top-level condlist
+bool inline_function(shmain* sh, function_t* fct, optimize_params* params)
+{
+  if(fct->redirs.size() > 0 || fct->lst == nullptr || fct->lst->size() <= 0)
+    return false;
+
+  inline_check chk;
+  recurse(r_inline_check, fct->lst, &chk);
+  inline_calls calls;
+  calls.name = fct->name;
+  recurse(r_get_inline_calls, fct->lst, &calls);
+  if(!chk.ok || calls.calls.size() > 0)
+    return false;
+
+  recurse(r_get_inline_calls, sh, &calls);
+  // recursive or dynamic calls
+  std::pair<std::string, uint32_t> word = std::make_pair(fct->name, 0);
+  recurse(r_count_word, sh, &word);
+  if(calls.calls.size() == 0 || word.second != calls.calls.size())
+    return false;
+
+  // size/benefit heuristic
+  size_t size = fct->lst->generate(0).size();
+  if(calls.calls.size() > 1 && (fct->lst->size() > 1 || size > INLINE_MAX_SIZE || size*(calls.calls.size()-1) > INLINE_MAX_GROWTH))
+    return false;
+
+  bool body_sets_env = has_env_set(fct->lst, &params->fcts);
+  for(auto it: calls.calls)
+    if(!can_inline_call(dynamic_cast<cmd_t*>(it.first->cmds[it.second]), &chk, body_sets_env))
+      return false;
+
+  for(auto it: calls.calls)
+  {
+    cmd_t* c = dynamic_cast<cmd_t*>(it.first->cmds[it.second]);
+    list_t* body = fct->lst->clone();
+    recurse(r_inline_positionals, body, &c->args->args);
+    brace_t* br = new brace_t(body);
+    br->redirs = c->redirs;
+    c->redirs.resize(0);
+    delete c;
+    it.first->cmds[it.second] = br;
+  }
+  params->inline_fct += calls.calls.size();
+  return true;
+}
+
+void inline_functions(shmain* sh, optimize_params* params)
+{
+  bool dynamic=false;
+  recurse(r_has_dynamic_cmd, sh, &dynamic);
+  if(dynamic)
+    return;
+
+  require_rescan_all();
+  fctcmdmap_get(sh, regex_null, regex_null);
+  set_t inlined;
+  for(auto cl: sh->lst->cls)
+  {
+    block_t* bl = cl->first_block();
+    if(cl->pls.size() != 1 || cl->pls[0]->cmds.size() != 1 || bl == nullptr || bl->type != _obj::block_function)
+      continue;
+    function_t* fct = dynamic_cast<function_t*>(bl);
+    // defined once, called at least once
+    if(m_fcts[fct->name] == 1 && m_cmds.find(fct->name) != m_cmds.end() && inline_function(sh, fct, params))
+      inlined.insert(fct->name);
+  }
+  // definitions are now unused
+  if(inlined.size() > 0)
+  {
+    recurse(r_delete_fct, sh, &inlined);
+    for(auto it: inlined)
+      params->fcts.erase(it);
+    require_rescan_all();
+  }
+}
+
+/** RECURSIVES **/
+
+// replace subshells that don't change the environment with braces: saves a fork
+bool r_subshell_to_brace(_obj* in, optimize_params* params)
+{
+  switch(in->type)
+  {
+    case _obj::pipeline: {
+      pipeline_t* t = dynamic_cast<pipeline_t*>(in);
+      for(uint32_t i=0; i<t->cmds.size(); i++)
+      {
+        if(t->cmds[i]->type != _obj::block_subshell)
+          continue;
+        subshell_t* sb = dynamic_cast<subshell_t*>(t->cmds[i]);
+        if(sb->lst == nullptr || sb->lst->size() <= 0 || has_env_set(sb->lst, &params->fcts))
+          continue;
+
+        brace_t* br = new brace_t(sb->lst);
+        br->redirs = sb->redirs;
+        // deindex
+        sb->lst = nullptr;
+        sb->redirs.resize(0);
+        delete sb;
+        t->cmds[i] = br;
+        params->subshell_to_brace++;
+      }
+    }; break;
+    default: break;
+  }
+  return true;
+}
+
+// replacement of a command substitution, nullptr if not applicable
+// $(printf %s "$VAR")     -> ${VAR%"${VAR##*[!\n]}"}
+// $(expr A OP B)          -> $((A OP B))
+// $(echo STR...)          -> STR...
+// $(basename STR)         -> result, same for dirname
+// computed output of a command substitution, made of plain string characters
+// inside double quotes it is kept as is, otherwise it is a single quoted word:
+// it can't become an assignment, a keyword or be split.
+// nullptr when it would split into several words or none
+subarg_t* make_cmdsubst_string(std::string const& str, bool quoted)
+{
+  if(quoted)
+    return new subarg_string_t(str);
+  if(str.size() == 0 || str.find(' ') != std::string::npos)
+    return nullptr;
+  return new subarg_string_t('\'' + str + '\'');
+}
+
+subarg_t* do_optimize_cmdsubst(subarg_subshell_t* in, bool allow_status_change, countmap_t* fcts)
+{
+  cmd_t* c = get_cmdsubst_cmd(in->sbsh);
+  if(c == nullptr || c->arglist_size() < 1)
+    return nullptr;
+  std::string const& cmdstr = c->arg_string(0);
+  // redefined by a function
+  if(fcts->find(cmdstr) != fcts->end())
+    return nullptr;
+  std::vector<arg_t*>& args = c->args->args;
+
+  if(cmdstr == "printf" && args.size() == 3 && is_in_vector(args[1]->generate(0), {"%s", "\"%s\"", "'%s'"}))
+  {
+    variable_t* v = get_quoted_var(args[2]);
+    if(v == nullptr)
+      return nullptr;
+    // generated from the variable name: not a template
+    std::string strip = strf(STRIP_NEWLINES("%s"), v->varname.c_str(), v->varname.c_str());
+    arg_t* t = parse_arg(make_context(strip)).first;
+    subarg_t* ret = t->sa[0];
+    t->sa.resize(0);
+    delete t;
+    ret->quoted = in->quoted;
+    return ret;
+  }
+  else if(cmdstr == "expr" && args.size() == 4 && allow_status_change)
+  {
+    // expr has a non-zero status when the result is 0
+    std::string op = args[2]->generate(0);
+    if(op == "\\*" || op == "'*'" || op == "\"*\"")
+      op = "*";
+    if(!is_in_vector(op, {"+", "-", "*", "/", "%"}))
+      return nullptr;
+    arithmetic_t* a = make_expr_operand(args[1]);
+    arithmetic_t* b = make_expr_operand(args[3]);
+    // division by zero is an error in expr, it exits the shell in $(( ))
+    int64_t div;
+    if(b != nullptr && (op == "/" || op == "%") && (!get_arithmetic_number(b, &div) || div == 0))
+    {
+      delete b;
+      b = nullptr;
+    }
+    if(a == nullptr || b == nullptr)
+    {
+      delete a;
+      delete b;
+      return nullptr;
+    }
+    subarg_arithmetic_t* ret = new subarg_arithmetic_t(new arithmetic_operation_t(op, a, b));
+    ret->quoted = in->quoted;
+    return ret;
+  }
+  else if(cmdstr == "echo")
+  {
+    std::string str;
+    for(uint32_t i=1; i<args.size(); i++)
+    {
+      if(!is_plain_string(args[i]) || (i == 1 && args[i]->string()[0] == '-'))
+        return nullptr;
+      if(i > 1)
+        str += ' ';
+      str += args[i]->string();
+    }
+    return make_cmdsubst_string(str, in->quoted);
+  }
+  else if( (cmdstr == "basename" || cmdstr == "dirname") && args.size() == 2 && is_plain_string(args[1]) && args[1]->string()[0] != '-')
+  {
+    if(cmdstr == "basename")
+      return make_cmdsubst_string(posix_basename(args[1]->string()), in->quoted);
+    else
+      return make_cmdsubst_string(posix_dirname(args[1]->string()), in->quoted);
+  }
+  return nullptr;
+}
+
+// code generated from user names: parsed directly, not through the template cache
+static list_t* parse_code_list(std::string const& in)
+{
+  return std::get<0>(parse_list_until(make_context(in)));
+}
+
+// VAR=$(basename "$VAR2") and VAR=$(dirname "$VAR2") as a full command
+// replaced with parameter expansions, following POSIX basename/dirname
+list_t* do_optimize_basename_dirname(condlist_t* in, countmap_t* fcts)
+{
+  if(in->pls.size() != 1 || in->parallel || in->pls[0]->negated || in->pls[0]->bash_time || in->pls[0]->cmds.size() != 1)
+    return nullptr;
+  if(in->pls[0]->cmds[0]->type != _obj::block_cmd)
+    return nullptr;
+  cmd_t* c = dynamic_cast<cmd_t*>(in->pls[0]->cmds[0]);
+  if(c->arglist_size() > 0 || c->redirs.size() > 0 || c->var_assigns.size() != 1)
+    return nullptr;
+
+  variable_t* v = c->var_assigns[0].first;
+  arg_t* val = c->var_assigns[0].second;
+  if(v == nullptr || v->index != nullptr || val == nullptr)
+    return nullptr;
+  // value is $(CMD) or "$(CMD)"
+  subarg_t* sa = nullptr;
+  if(val->sa.size() == 2 && val->sa[0]->type == _obj::subarg_string && dynamic_cast<subarg_string_t*>(val->sa[0])->val == "=")
+    sa = val->sa[1];
+  else if(val->sa.size() == 4 && val->sa[0]->type == _obj::subarg_string && val->sa[3]->type == _obj::subarg_string
+      && dynamic_cast<subarg_string_t*>(val->sa[0])->val == "=\"" && dynamic_cast<subarg_string_t*>(val->sa[3])->val == "\"")
+    sa = val->sa[2];
+  if(sa == nullptr || sa->type != _obj::subarg_subshell)
+    return nullptr;
+
+  cmd_t* sc = get_cmdsubst_cmd(dynamic_cast<subarg_subshell_t*>(sa)->sbsh);
+  if(sc == nullptr || sc->arglist_size() != 2)
+    return nullptr;
+  if(fcts->find(sc->arg_string(0)) != fcts->end())
+    return nullptr;
+  variable_t* sv = get_quoted_var(sc->args->args[1]);
+  if(sv == nullptr || sv->varname == v->varname)
+    return nullptr;
+
+  const char* y = v->varname.c_str();
+  const char* x = sv->varname.c_str();
+  if(sc->arg_string(0) == "basename")
+  {
+    return parse_code_list(strf(
+      "%s=${%s%%\"${%s##*[!/]}\"}\n"
+      "%s=${%s##*/}\n"
+      "%s=${%s:-${%s:+/}}\n"
+      "%s=" STRIP_NEWLINES("%s") "\n",
+      y, x, x,
+      y, y,
+      y, y, x,
+      y, y, y));
+  }
+  else if(sc->arg_string(0) == "dirname")
+  {
+    return parse_code_list(strf(
+      "%s=${%s%%\"${%s##*[!/]}\"}\n"
+      "case $%s in\n"
+      "  */*) %s=${%s%%/*} ; %s=${%s%%\"${%s##*[!/]}\"} ; %s=${%s:-/} ;;\n"
+      "  *) [ -z \"$%s\" ] && [ -n \"$%s\" ] && %s=/ || %s=. ;;\n"
+      "esac\n"
+      "%s=" STRIP_NEWLINES("%s") "\n",
+      y, x, x,
+      y,
+      y, y, y, y, y, y, y,
+      y, x, y, y,
+      y, y, y));
+  }
+  return nullptr;
+}
+
+// $(... | grep ARGS | wc -l) -> $(... | grep -c ARGS)
+// grep -c fails when nothing matches: only when the status is not used
+bool do_optimize_grep_count(subarg_subshell_t* in, countmap_t* fcts)
+{
+  subshell_t* sb = in->sbsh;
+  if(sb == nullptr || sb->lst == nullptr || sb->redirs.size() > 0 || sb->lst->cls.size() != 1)
+    return false;
+  condlist_t* cl = sb->lst->cls[0];
+  if(cl->parallel || cl->pls.size() != 1)
+    return false;
+  pipeline_t* pl = cl->pls[0];
+  uint32_t n = pl->cmds.size();
+  if(n < 2)
+    return false;
+  cmd_t* grep = get_bare_cmd(pl->cmds[n-2], fcts);
+  cmd_t* wc = get_bare_cmd(pl->cmds[n-1], fcts);
+  if(grep == nullptr || wc == nullptr || wc->arglist_size() != 2 || wc->arg_string(0) != "wc" || wc->arg_string(1) != "-l" || !is_countable_grep(grep))
+    return false;
+  grep->args->insert(1, new arg_t("-c"));
+  delete wc;
+  pl->cmds.pop_back();
+  return true;
+}
+
+bool r_optimize_cmdsubst(_obj* in, optimize_params* params)
+{
+  switch(in->type)
+  {
+    case _obj::list: {
+      list_t* t = dynamic_cast<list_t*>(in);
+      for(uint32_t i=0; i<t->cls.size(); i++)
+      {
+        list_t* r = do_optimize_basename_dirname(t->cls[i], &params->fcts);
+        if(r != nullptr)
+        {
+          delete t->cls[i];
+          t->cls.erase(t->cls.begin()+i);
+          t->insert(i, *r);
+          i += r->size()-1;
+          r->cls.resize(0);
+          delete r;
+          params->cmdsubst++;
+        }
+      }
+    }; break;
+    case _obj::block_cmd: {
+      cmd_t* t = dynamic_cast<cmd_t*>(in);
+      // the status of an assignment is the status of its last substitution
+      if(t->arglist_size() == 0)
+        for(auto it: t->var_assigns)
+          params->status_args.insert(it.second);
+    }; break;
+    case _obj::arg: {
+      arg_t* t = dynamic_cast<arg_t*>(in);
+      bool allow_status_change = params->status_args.find(t) == params->status_args.end();
+      for(uint32_t i=0; i<t->sa.size(); i++)
+      {
+        if(t->sa[i]->type != _obj::subarg_subshell)
+          continue;
+        if(allow_status_change && do_optimize_grep_count(dynamic_cast<subarg_subshell_t*>(t->sa[i]), &params->fcts))
+          params->pipeline++;
+        subarg_t* r = do_optimize_cmdsubst(dynamic_cast<subarg_subshell_t*>(t->sa[i]), allow_status_change, &params->fcts);
+        if(r != nullptr)
+        {
+          delete t->sa[i];
+          t->sa[i] = r;
+          params->cmdsubst++;
+        }
+      }
+    }; break;
+    default: break;
+  }
+  return true;
+}
+
+// remove useless commands in pipelines
+// cat FILE | CMD       -> CMD < FILE, with --cat-redirect
+// echo STR | CMD       -> CMD <<EOF
+bool r_optimize_pipeline(_obj* in, optimize_params* params)
+{
+  switch(in->type)
+  {
+    case _obj::condlist: {
+      condlist_t* cl = dynamic_cast<condlist_t*>(in);
+      bool has_heredoc = has_here_document(cl);
+      for(auto pl: cl->pls)
+      {
+        // last element runs in the current shell once alone
+        if(pl->cmds.size() >= 2 && (pl->cmds.size() > 2 || !has_env_set(pl->cmds[1], &params->fcts)) && !has_stdin_redirect(pl->cmds[1]))
+        {
+          cmd_t* c = get_bare_cmd(pl->cmds[0], &params->fcts);
+          redirect_t* r = nullptr;
+          if(c != nullptr && c->arg_string(0) == "cat")
+          {
+            // a missing file stops CMD from running: opt-in
+            if(params->cat_redirect && c->arglist_size() == 2 && is_file_arg(c->args->args[1]))
+            {
+              r = new redirect_t("<", c->args->args[1]);
+              c->args->args.pop_back();
+            }
+          }
+          else if(c != nullptr && !has_heredoc)
+          {
+            r = make_output_heredoc(c);
+            has_heredoc = r != nullptr;
+          }
+          if(r != nullptr)
+          {
+            pl->cmds[1]->redirs.push_back(r);
+            delete c;
+            pl->cmds.erase(pl->cmds.begin());
+            params->pipeline++;
+          }
+        }
+      }
+    }; break;
+    default: break;
+  }
+  return true;
+}
+
+/** OPTIMIZE **/
+
+void optimize(_obj* in, run_context* run)
+{
+  optimize_params params;
+  params.cat_redirect = run->options["cat-redirect"];
+  recurse(r_get_fct, in, &params.fcts);
+  if(run->options["inline-fct"] && in->type == _obj::block_main)
+    inline_functions(dynamic_cast<shmain*>(in), &params);
+  recurse(r_optimize_cmdsubst, in, &params);
+  recurse(r_fold_arithmetic, in, &params.arithmetic);
+  recurse(r_optimize_pipeline, in, &params);
+  recurse(r_subshell_to_brace, in, &params);
+
+  if(run->options["optimize-report"])
+  {
+    std::cerr << "Forks removed by optimization:\n";
+    std::cerr << "  command substitutions: " << params.cmdsubst << '\n';
+    std::cerr << "  pipelines: " << params.pipeline << '\n';
+    std::cerr << "  subshells: " << params.subshell_to_brace << '\n';
+    std::cerr << "  total: " << params.cmdsubst+params.pipeline+params.subshell_to_brace << '\n';
+    std::cerr << "Function calls inlined: " << params.inline_fct << '\n';
+    std::cerr << "Arithmetic operations folded: " << params.arithmetic << '\n';
+  }
+}
@@ -2,14 +2,16 @@
 
 #include "processing.hpp"
 #include "shellcode.hpp"
+#include "compress.hpp"
+#include "cache.hpp"
 
 #include "errcodes.h"
 #include "version.h"
 #include "g_version.h"
 
-bool opt_minify=false;
+thread_local bool opt_minify=false;
 
-ztd::option_set options( {
+run_context g_ctx = { .options=ztd::option_set( {
   ztd::option("\r  [Help]"),
   ztd::option('h', "help",          false, "Display this help message"),
   ztd::option("version",            false, "Display version"),
@@ -19,7 +21,15 @@ ztd::option_set options( {
   ztd::option('o', "output",        true , "Output result script to file", "file"),
   ztd::option('c', "stdout",        false, "Output result script to stdout"),
   ztd::option('e', "exec",          false, "Directly execute script"),
+  ztd::option("no-cache",           false, "Don't use the compile cache when executing"),
+  ztd::option("daemon",             true , "Serve the runs of lxsh with LXSH_SOCKET set to this socket", "socket"),
+  ztd::option("batch",              false, "Compile each file separately to --outdir, in parallel up to -j"),
+  ztd::option("outdir",             true , "Output directory of --batch", "dir"),
+  ztd::option("lsp",                false, "Run a language server on stdin and stdout"),
+  ztd::option("watch",              false, "Compile again to -o when the file or its includes change"),
   ztd::option("no-shebang",         false, "Don't output shebang"),
+  ztd::option("compress",           true , "Output a self-extracting script compressed with gzip, xz or zstd. It reads itself from $0: it can't be sourced or piped", "method"),
+  ztd::option("compress-report",    false, "Print output size and decompression time of --compress to stderr"),
   ztd::option('P', "map",           true , "Output var and fct minify map to given file", "file"),
 #ifdef DEBUG_MODE
   ztd::option("\r  [Debugging]"),
@@ -27,17 +37,27 @@ ztd::option_set options( {
 #endif
   ztd::option("\r  [Processing]"),
   ztd::option('m', "minify",        false, "Minify code without changing functionality"),
-  ztd::option('M', "minify-full",   false, "Enable all minifying features: -m --minify-var --minify-fct --remove-unused"),
+  ztd::option('M', "minify-full",   false, "Enable all minifying features: -m --minify-var --minify-fct --minify-str --remove-unused"),
+  ztd::option("minify-str",         false, "Replace repeated strings with variables when it reduces size"),
+  ztd::option('O', "optimize",      false, "Optimize code for execution speed. May increase size"),
+  ztd::option("optimize-report",    false, "Print the number of forks removed by -O to stderr"),
+  ztd::option("inline-fct",         false, "With -O: replace calls to small functions with their body"),
+  ztd::option("cat-redirect",       false, "With -O: replace 'cat FILE | CMD' with 'CMD < FILE'. CMD isn't run when FILE can't be read"),
   ztd::option('A', "apply-map",     true , "Apply var/fct minify map from given file", "file"),
   ztd::option('C', "no-cd",         false, "Don't cd when doing %include and %resolve"),
   ztd::option('I', "no-include",    false, "Don't resolve %include commands"),
   ztd::option('R', "no-resolve",    false, "Don't resolve %resolve commands"),
+  ztd::option("parallel-resolve",   false, "Run the %resolve commands of a file concurrently, up to -j at a time"),
+  ztd::option("resolve-cache",      true , "Cache the output of all %resolve commands in given directory", "dir"),
+  ztd::option("resolve-ttl",        true , "Default time in seconds before a cached %resolve output expires. Default: none", "seconds"),
+  ztd::option("resolve-refresh",    false, "Run cached %resolve commands again and update their cache"),
   ztd::option("no-extend",          false, "Don't add lxsh extension functions"),
   ztd::option("bash",               false, "Force bash parsing"),
   ztd::option("lxsh",               false, "Force lxsh parsing"),
   ztd::option("debashify",          false, "Attempt to turn a bash-specific script into a POSIX shell script"),
   ztd::option("remove-unused",      false, "Remove unused functions and variables"),
   ztd::option("list-cmd",           false, "List all commands invoked in the script"),
+  ztd::option('j', "jobs",          true , "Number of threads used for processing. Default: number of cores", "n"),
   ztd::option("\r  [Variable processing]"),
   ztd::option("exclude-var",        true,  "List of matching regex to ignore for variable processing, separated by spaces", "list"),
   ztd::option("no-exclude-reserved",false, "Don't exclude reserved variables"),
@@ -50,43 +70,68 @@ ztd::option_set options( {
   ztd::option("exclude-fct",        true,  "List of matching regex to ignore for function processing, separated by spaces", "list"),
   ztd::option("minify-fct",         false, "Minify function names"),
   ztd::option("list-fct",           false, "List all functions defined in the script")
-} );
+} ) };
 
-bool g_cd=false;
-bool g_include=true;
-bool g_resolve=true;
-bool g_shebang=true;
+ztd::option_set& options=g_ctx.options;
+bool& g_cd=g_ctx.cd;
+bool& g_include=g_ctx.include;
+bool& g_resolve=g_ctx.resolve;
+bool& g_shebang=g_ctx.shebang;
+uint32_t& g_jobs=g_ctx.jobs;
 
-void get_opts()
+void get_opts(run_context* run)
 {
-  g_cd=!options['C'].activated;
-  g_include=!options["no-include"].activated;
-  g_resolve=!options["no-resolve"].activated;
-  g_shebang=!options["no-shebang"].activated;
-  if(options["exclude-var"])
-    re_var_exclude=var_exclude_regex(options["exclude-var"], !options["no-exclude-reserved"]);
+  run->cd=!run->options['C'].activated;
+  run->include=!run->options["no-include"].activated;
+  run->resolve=!run->options["no-resolve"].activated;
+  run->shebang=!run->options["no-shebang"].activated;
+  if(run->options['j'])
+  {
+    try {
+      int n = std::stoi(run->options['j'].argument);
+      if(n < 1)
+        throw std::out_of_range("negative");
+      run->jobs=n;
+    }
+    catch(std::exception& e) {
+      throw option_value_error("Invalid number of jobs: "+run->options['j'].argument);
+    }
+  }
+  if(run->options["compress"] && !is_compress_method(run->options["compress"].argument))
+    throw option_value_error("Invalid compression method: "+run->options["compress"].argument);
+  if(run->options["resolve-ttl"])
+  {
+    try {
+      parse_ttl(run->options["resolve-ttl"].argument);
+    }
+    catch(std::runtime_error& e) {
+      throw option_value_error(e.what());
+    }
+  }
+  if(run->options["exclude-var"])
+    run->re_var_exclude=var_exclude_regex(run->options["exclude-var"], !run->options["no-exclude-reserved"]);
   else
-    re_var_exclude=var_exclude_regex("", !options["no-exclude-reserved"]);
-  if(options["exclude-fct"])
-    re_fct_exclude=fct_exclude_regex(options["exclude-fct"]);
-  if(options['M'])
+    run->re_var_exclude=var_exclude_regex("", !run->options["no-exclude-reserved"]);
+  if(run->options["exclude-fct"])
+    run->re_fct_exclude=fct_exclude_regex(run->options["exclude-fct"]);
+  if(run->options['M'])
   {
-    options['m'].activated=true;
-    options["minify-var"].activated=true;
-    options["minify-fct"].activated=true;
-    options["remove-unused"].activated=true;
+    run->options['m'].activated=true;
+    run->options["minify-var"].activated=true;
+    run->options["minify-fct"].activated=true;
+    run->options["minify-str"].activated=true;
+    run->options["remove-unused"].activated=true;
   }
-  if(options['o'].argument == "-")
-    options['o'].argument = "/dev/stdout";
-  if(options['P'].argument == "-")
-    options['P'].argument = "/dev/stdout";
-  if(options['A'].argument == "-")
-    options['A'].argument = "/dev/stdin";
+  if(run->options['o'].argument == "-")
+    run->options['o'].argument = "/dev/stdout";
+  if(run->options['P'].argument == "-")
+    run->options['P'].argument = "/dev/stdout";
+  if(run->options['A'].argument == "-")
+    run->options['A'].argument = "/dev/stdin";
   if(
-      options['A'] && ( options['P'] || options["minify-var"] || options["minify-fct"] )
+      run->options['A'] && ( run->options['P'] || run->options["minify-var"] || run->options["minify-fct"] )
     ) {
-      printf("Incompatible options\n");
-      exit(ERR_OPT);
+      throw option_value_error("Incompatible options");
   }
 }
 
@@ -102,7 +147,11 @@ ztd::option_set create_resolve_opts()
 {
   return std::vector<ztd::option>({
     ztd::option('C', false, "Don't cd to folder this file is in"),
-    ztd::option('f', false, "Ignore non-zero return values")
+    ztd::option('f', false, "Ignore non-zero return values"),
+    ztd::option('c', false, "Cache the output, in the lxsh cache dir unless --resolve-cache is given"),
+    ztd::option('t', true,  "Time in seconds before the cached output expires", "seconds"),
+    ztd::option('i', true,  "Files the output depends on, separated by spaces", "files"),
+    ztd::option('E', true,  "Environment variables the output depends on, separated by spaces", "vars")
   });
 }
 
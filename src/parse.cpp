@@ -41,7 +41,10 @@ std::string unexpected_token(std::string const& s)
 
 void parse_error(std::string const& message, parse_context& ctx)
 {
-  printFormatError(format_error(message, ctx));
+  if(ctx.errors != nullptr)
+    ctx.errors->push_back({ctx.i, message});
+  else
+    printFormatError(format_error(message, ctx));
   ctx.has_errored=true;
 }
 
@@ -49,7 +52,7 @@ void parse_error(std::string const& message, parse_context& ctx, uint64_t i)
 {
   parse_context newctx = ctx;
   newctx.i = i;
-  printFormatError(format_error(message, newctx));
+  parse_error(message, newctx);
   ctx.has_errored=true;
 }
 
@@ -226,6 +229,7 @@ std::pair<variable_t*, parse_context> parse_var(parse_context ctx, bool specialv
   if(varname != "")
   {
     ret = new variable_t(varname);
+    ret->pos = start;
     if(ctx.bash && array && ctx[ctx.i]=='[')
     {
       ctx.i++;
@@ -649,12 +653,27 @@ parse_context parse_heredocument(parse_context ctx)
   {
     ctx.i = ctx.size;
   }
-  parse_context newctx = make_context(ctx, j);
-  newctx.size = ctx.i;
-  auto pval = parse_arg(newctx , NULL, NULL, false, ARG_OPTIMIZE_NULL);
-  ctx.i = pval.second.i;
-  ctx.has_errored = pval.second.has_errored;
-  ctx.here_document->here_document = pval.first;
+  std::string target = ctx.here_document->target->string();
+  if(target.find('"') != std::string::npos || target.find('\'') != std::string::npos || target.find('\\') != std::string::npos)
+  {
+    // quoted delimitor: no expansion in the document
+    ctx.here_document->here_document = new arg_t(std::string(ctx.data+j, ctx.i-j));
+  }
+  else
+  {
+    parse_context newctx = make_context(ctx, j);
+    newctx.size = ctx.i;
+    // the document belongs to this context only
+    newctx.here_document = nullptr;
+    newctx.here_delimitor = NULL;
+    auto pval = parse_arg(newctx , NULL, NULL, false, ARG_OPTIMIZE_NULL);
+    ctx.i = pval.second.i;
+    ctx.has_errored = pval.second.has_errored;
+    // substitutions in a document are not split, as in double quotes
+    for(auto it: pval.first->sa)
+      it->quoted = true;
+    ctx.here_document->here_document = pval.first;
+  }
 
   //
   ctx.here_document=nullptr;
@@ -1040,13 +1059,14 @@ std::tuple<list_t*, parse_context, std::string> parse_list_until(parse_context c
   std::vector<std::string>& end_words = opts.end_words;
 
   const char* old_expect=ctx.expecting;
+  std::string end_str(1, end_c);
 
   if(opts.expecting!=NULL)
     ctx.expecting=opts.expecting;
   else if(opts.word_mode)
     ctx.expecting=end_words[0].c_str();
   else
-    ctx.expecting=std::string(&end_c, 1).c_str();
+    ctx.expecting=end_str.c_str();
 
   bool stop=false;
   while(true)
@@ -1079,6 +1099,15 @@ std::tuple<list_t*, parse_context, std::string> parse_list_until(parse_context c
     {
       break;
     }
+    if(opts.index != nullptr)
+    {
+      bool resumable = ctx.here_document == nullptr;
+      if(resumable && opts.index->stop_at.count(ctx.i) > 0)
+        break;
+      opts.index->starts.push_back(ctx.i);
+      opts.index->resumable.push_back(resumable);
+      opts.index->first_error.push_back(ctx.errors != nullptr ? ctx.errors->size() : 0);
+    }
     // do a parse
     auto pp=parse_condlist(ctx);
     ret->add(pp.first);
@@ -1147,6 +1176,7 @@ std::tuple<list_t*, parse_context, std::string> parse_list_until(parse_context c
       if(opts.word_mode || opts.end_char != 0)
       {
         parse_error(strf("Expecting '%s'", ctx.expecting), ctx);
+        ctx.expecting=old_expect;
         return std::make_tuple(ret, ctx, "");
       }
       else
@@ -1346,6 +1376,7 @@ std::pair<cmd_t*, parse_context> parse_cmd(parse_context ctx)
   cmd_t* ret = new cmd_t;
 
   ctx = parse_cmd_varassigns(ret, ctx);
+  ret->pos = ctx.i;
 
   auto wp=get_word(ctx, ARG_END);
   bool is_bash_cmdvar=false;
@@ -1543,6 +1574,7 @@ std::pair<for_t*, parse_context> parse_for(parse_context ctx)
     parse_error( strf("Bad variable name in for clause: '%s'", wp.first.c_str()), ctx );
   }
   ret->var = new variable_t(wp.first, nullptr, true);
+  ret->var->pos = ctx.i;
   ctx.i = wp.second;
   ctx.i=skip_chars(ctx, SPACES);
 
@@ -1702,6 +1734,7 @@ std::pair<block_t*, parse_context> parse_block(parse_context ctx)
         newct.has_errored=true;
       }
       newct.i = skip_unread(newct);
+      uint64_t name_pos = newct.i;
       auto wp2=get_word(newct, BASH_BLOCK_END);
       if(!valid_name(wp2.first))
       {
@@ -1719,6 +1752,7 @@ std::pair<block_t*, parse_context> parse_block(parse_context ctx)
       auto pp = parse_function(newct, "function definition");
       // function name
       pp.first->name = wp2.first;
+      pp.first->pos = name_pos;
       ret = pp.first;
       ctx = pp.second;
     }
@@ -1734,6 +1768,7 @@ std::pair<block_t*, parse_context> parse_block(parse_context ctx)
       auto pp = parse_function(newct);
       // first arg is function name
       pp.first->name = word;
+      pp.first->pos = ctx.i;
       ret = pp.first;
       ctx = pp.second;
     }
@@ -1764,7 +1799,7 @@ std::pair<block_t*, parse_context> parse_block(parse_context ctx)
 }
 
 // parse main
-std::pair<shmain*, parse_context> parse_text(parse_context ctx)
+std::pair<shmain*, parse_context> parse_text(parse_context ctx, list_index* index)
 {
   shmain* ret = new shmain();
 
@@ -1781,11 +1816,11 @@ std::pair<shmain*, parse_context> parse_text(parse_context ctx)
   if(!ctx.bash)
     ctx.bash = (binshebang == "bash" || binshebang == "lxsh");
   // parse all commands
-  auto pp=parse_list_until(ctx);
+  auto pp=parse_list_until(ctx, {.index=index});
   ret->lst=std::get<0>(pp);
   ctx = std::get<1>(pp);
 
-  if(ctx.has_errored)
+  if(ctx.has_errored && ctx.errors == nullptr)
     throw std::runtime_error("Aborted due to previous errors");
 
   return std::make_pair(ret, ctx);
@@ -1796,6 +1831,109 @@ std::pair<shmain*, parse_context> parse_text(std::string const& in, std::string
   return parse_text({ .data=in.c_str(), .size=in.size(), .filename=filename.c_str()});
 }
 
+// incremental parsing
+
+parse_tree::parse_tree(std::string const& text, std::string const& file, bool isbash)
+{
+  txt=text;
+  filename=file;
+  bash=isbash;
+  parse_all();
+}
+
+void parse_tree::parse_all()
+{
+  first = 0;
+  removed = sh != nullptr ? sh->lst->size() : 0;
+  delete sh;
+  sh=nullptr;
+  errors.clear();
+  index = list_index();
+  parse_context ctx = make_context(txt, filename, bash);
+  ctx.errors = &errors;
+  auto pp = parse_text(ctx, &index);
+  sh = pp.first;
+  parsed_bash = pp.second.bash;
+  parsed = sh->lst->size();
+}
+
+void parse_tree::edit(uint64_t start, uint64_t end, std::string const& str)
+{
+  if(start > end || end > txt.size())
+    throw std::out_of_range("Edit out of text");
+  txt.replace(start, end-start, str);
+  int64_t delta = (int64_t) str.size() - (int64_t) (end-start);
+
+  // the shebang decides of bash mode
+  std::vector<uint64_t>& starts = index.starts;
+  if(starts.size() == 0 || start < starts[0])
+  {
+    parse_all();
+    return;
+  }
+
+  // first command to parse again: the one containing the edit,
+  // or the one before if the edit is on its start, as separators belong to the previous command
+  first = std::upper_bound(starts.begin(), starts.end(), start) - starts.begin() - 1;
+  if(starts[first] == start && first > 0)
+    first--;
+  while(first > 0 && !index.resumable[first])
+    first--;
+
+  // parse until reaching an unchanged command
+  list_index newindex;
+  for(uint32_t i=first+1; i<starts.size(); i++)
+  {
+    if(starts[i] >= end && index.resumable[i])
+      newindex.stop_at.insert(starts[i]+delta);
+  }
+  std::vector<parse_diagnostic> newerrors;
+  parse_context ctx = make_context(txt, filename, parsed_bash);
+  ctx.errors = &newerrors;
+  ctx.i = starts[first];
+  auto pp = parse_list_until(ctx, {.index=&newindex});
+  list_t* lst = std::get<0>(pp);
+  ctx = std::get<1>(pp);
+
+  uint32_t last = starts.size();
+  if(ctx.i < ctx.size && newindex.stop_at.count(ctx.i) > 0)
+    last = std::lower_bound(starts.begin(), starts.end(), ctx.i-delta) - starts.begin();
+
+  // replace commands [first, last)
+  std::vector<condlist_t*>& cls = sh->lst->cls;
+  for(uint32_t i=first; i<last; i++)
+    delete cls[i];
+  cls.erase(cls.begin()+first, cls.begin()+last);
+  cls.insert(cls.begin()+first, lst->cls.begin(), lst->cls.end());
+  lst->cls.clear();
+  delete lst;
+
+  // and their errors
+  uint32_t first_err = index.first_error[first];
+  uint32_t last_err = last < starts.size() ? index.first_error[last] : errors.size();
+  for(uint32_t i=last_err; i<errors.size(); i++)
+    errors[i].i += delta;
+  errors.erase(errors.begin()+first_err, errors.begin()+last_err);
+  errors.insert(errors.begin()+first_err, newerrors.begin(), newerrors.end());
+  int64_t err_delta = (int64_t) newerrors.size() - (int64_t) (last_err-first_err);
+
+  for(uint32_t i=last; i<starts.size(); i++)
+  {
+    starts[i] += delta;
+    index.first_error[i] += err_delta;
+  }
+  for(auto& it: newindex.first_error)
+    it += first_err;
+  starts.erase(starts.begin()+first, starts.begin()+last);
+  starts.insert(starts.begin()+first, newindex.starts.begin(), newindex.starts.end());
+  index.resumable.erase(index.resumable.begin()+first, index.resumable.begin()+last);
+  index.resumable.insert(index.resumable.begin()+first, newindex.resumable.begin(), newindex.resumable.end());
+  index.first_error.erase(index.first_error.begin()+first, index.first_error.begin()+last);
+  index.first_error.insert(index.first_error.begin()+first, newindex.first_error.begin(), newindex.first_error.end());
+  removed = last-first;
+  parsed = newindex.starts.size();
+}
+
 // import a file's contents into a string
 std::string import_file(std::string const& path)
 {
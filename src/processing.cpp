@@ -1,6 +1,7 @@
 #include "processing.hpp"
 
 #include <cmath>
+#include <mutex>
 
 #include "recursive.hpp"
 #include "parse.hpp"
@@ -14,18 +15,15 @@
 
 // Global regex
 
-std::regex re_var_exclude;
-std::regex re_fct_exclude;
-
 const std::regex regex_null;
 
 // Object maps
 
-countmap_t m_vars, m_vardefs, m_varcalls;
-countmap_t m_fcts, m_cmds;
-set_t m_excluded_var, m_excluded_fct, m_excluded_cmd;
+thread_local countmap_t m_vars, m_vardefs, m_varcalls;
+thread_local countmap_t m_fcts, m_cmds;
+thread_local set_t m_excluded_var, m_excluded_fct, m_excluded_cmd;
 
-bool b_gotvar=false, b_gotfct=false, b_gotcmd=false;
+thread_local bool b_gotvar=false, b_gotfct=false, b_gotcmd=false;
 
 // requires
 
@@ -99,14 +97,22 @@ inline std::vector<std::string> get_list(std::string const& in)
   return split(in, ", \t\n");
 }
 
+// compiled once per process: children of --batch and sessions reuse them
 std::regex gen_regex_from_list(std::vector<std::string> const& in)
 {
+  static std::map<std::string,std::regex> cache;
+  static std::mutex cache_mutex;
+
   std::string re;
   for(auto it: in)
     re += '('+it+")|";
   if(re.size()>0)
     re.pop_back();
-  return std::regex(re);
+  std::lock_guard<std::mutex> lock(cache_mutex);
+  auto it = cache.find(re);
+  if(it == cache.end())
+    it = cache.insert(std::make_pair(re, std::regex(re))).first;
+  return it->second;
 }
 
 std::vector<std::string> gen_var_excludes(std::string const& in, bool include_reserved)
@@ -297,9 +303,10 @@ void add_unset_variables(shmain* sh, std::regex const& exclude)
   }
 }
 
-bool has_env_set(_obj* in) {
+// fcts: functions defined in the script, calling them is considered as setting env
+bool has_env_set(_obj* in, countmap_t* fcts) {
   bool r=false;
-  recurse(r_has_env_set, in, &r);
+  recurse(r_has_env_set, in, &r, fcts);
   return r;
 }
 
@@ -307,21 +314,67 @@ bool has_env_set(_obj* in) {
 
 // CHECK //
 
-bool r_has_env_set(_obj* in, bool* result)
+// builtins changing the state of the current shell
+const std::set<std::string> env_set_builtins = {
+  "cd", "pushd", "popd", "set", "shift", "trap", "exit", "return", "break", "continue", "umask", "ulimit",
+  "exec", "eval", ".", "source", "alias", "unalias", "hash", "shopt", "enable", "let", "mapfile", "readarray",
+  "wait", "jobs", "fg", "bg", "disown"
+};
+
+bool r_has_env_set(_obj* in, bool* result, countmap_t* fcts)
 {
+  if(*result)
+    return false;
   switch(in->type)
   {
     case _obj::block_subshell: {
       return false;
     }; break;
+    case _obj::block_function: {
+      *result = true;
+    }; break;
+    case _obj::condlist: {
+      condlist_t* t = dynamic_cast<condlist_t*>(in);
+      // background job: sets $!
+      if(t->parallel)
+        *result = true;
+    }; break;
+    case _obj::variable: {
+      variable_t* t = dynamic_cast<variable_t*>(in);
+      // ${VAR=val} and ${VAR:=val}
+      if(t->definition || (t->is_manip && !t->precedence && t->manip != nullptr &&
+          (t->manip->first_sa_string().substr(0,1) == "=" || t->manip->first_sa_string().substr(0,2) == ":=") ) )
+        *result = true;
+    }; break;
+    case _obj::arithmetic_operation: {
+      arithmetic_operation_t* t = dynamic_cast<arithmetic_operation_t*>(in);
+      if(t->oper.size() > 0 && t->oper.back() == '=' && t->oper != "==" && t->oper != "!=" && t->oper != "<=" && t->oper != ">=")
+        *result = true;
+    }; break;
     case _obj::block_cmd: {
       cmd_t* t = dynamic_cast<cmd_t*>(in);
-      if(t->has_var_assign() || t->arg_string(0) == "cd")
+      if(t->has_var_assign())
+      {
         *result = true;
-    }
+        break;
+      }
+      if(t->arglist_size() == 0)
+        break;
+      uint32_t i = 0;
+      if(t->arg_string(0) == "command" || t->arg_string(0) == "builtin")
+        i = 1;
+      if(t->arglist_size() <= i)
+        break;
+      std::string const& cmdstr = t->arg_string(i);
+      if( cmdstr == "" || // dynamic command
+          env_set_builtins.find(cmdstr) != env_set_builtins.end() ||
+          (cmdstr == "printf" && t->arg_string(i+1) == "-v") ||
+          (fcts != nullptr && fcts->find(cmdstr) != fcts->end()) )
+        *result = true;
+    }; break;
     default: break;
   }
-  return true;
+  return !*result;
 }
 
 // GET //
@@ -545,7 +598,7 @@ std::set<std::string> get_processors(std::string const& in)
   return ret;
 }
 
-bool r_do_string_processor(_obj* in)
+bool r_do_string_processor(_obj* in, run_context* run)
 {
   if(in->type == _obj::subarg_string)
   {
@@ -558,14 +611,14 @@ bool r_do_string_processor(_obj* in)
         std::string stringcode = t->val.substr(1, t->val.size()-2);
         shmain* tsh = parse_text( stringcode ).first;
         require_rescan_all();
-        if(options["remove-unused"])
-          delete_unused( tsh, re_var_exclude, re_fct_exclude );
-        if(options["minify"])
-          minify_generic(tsh);
-        if(options["minify-var"])
-          minify_var( tsh, re_var_exclude );
-        if(options["minify-fct"])
-          minify_fct( tsh, re_fct_exclude );
+        if(run->options["remove-unused"])
+          delete_unused( tsh, run->re_var_exclude, run->re_fct_exclude );
+        if(run->options["minify"])
+          minify_generic(tsh, run);
+        if(run->options["minify-var"])
+          minify_var( tsh, run->re_var_exclude );
+        if(run->options["minify-fct"])
+          minify_fct( tsh, run->re_fct_exclude );
         require_rescan_all();
         t->val='\'' + tsh->generate(false, 0) + '\'';
       }
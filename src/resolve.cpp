@@ -1,14 +1,19 @@
 #include "resolve.hpp"
 
 #include <unistd.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <map>
+#include <deque>
 #include <ztd/shell.hpp>
 
 #include "recursive.hpp"
 #include "options.hpp"
 #include "util.hpp"
 #include "parse.hpp"
-
-std::vector<std::string> included;
+#include "cache.hpp"
+#include "exec.hpp"
 
 // -- CD STUFF --
 
@@ -22,38 +27,51 @@ std::string pwd()
   return std::string(buf);
 }
 
-bool add_include(std::string const& file)
+std::string current_dir(run_context* run)
+{
+  if(run->dir == "")
+    return pwd();
+  return run->dir;
+}
+
+std::string include_path(std::string const& file, run_context* run)
 {
-  std::string truepath;
   if(file[0] == '/')
-    truepath = file;
-  else
-    truepath=pwd() + '/' + file;
-  for(auto it: included)
+    return file;
+  return current_dir(run) + '/' + file;
+}
+
+bool add_include(std::string const& file, run_context* run)
+{
+  std::string truepath = include_path(file, run);
+  for(auto it: run->included)
   {
     if(it == truepath)
       return false;
   }
-  included.push_back(truepath);
+  run->included.push_back(truepath);
   return true;
 }
 
 // returns path to old dir
-std::string _pre_cd(std::string const& filename)
+std::string _pre_cd(std::string const& filename, run_context* run)
 {
   if(filename == "" || is_dev_file(filename))
     return "";
-  std::string dir=pwd();
+  std::string dir=current_dir(run);
   std::string cddir=dirname(filename);
-  if(chdir(cddir.c_str()) != 0)
+  char buf[PATH_MAX];
+  struct stat st;
+  if(realpath(include_path(cddir != "" ? cddir : "/", run).c_str(), buf) == NULL || stat(buf, &st) != 0 || !S_ISDIR(st.st_mode))
     throw std::runtime_error("Cannot cd to '"+cddir+"'");
+  run->dir=buf;
   return dir;
 }
 
-void _cd(std::string const& dir)
+void _cd(std::string const& dir, run_context* run)
 {
-  if(dir!="" && chdir(dir.c_str()) != 0)
-    throw std::runtime_error("Cannot cd to '"+dir+"'");
+  if(dir!="")
+    run->dir=dir;
 }
 
 // -- COMMANDS --
@@ -74,10 +92,16 @@ std::vector<std::pair<std::string, std::string>> do_include_raw(condlist_t* cmd,
     throw std::runtime_error(std::string("%include: ")+e.what());
   }
 
+  run_context* run = ctx.run;
+  // expanded paths can change without any file changing
+  for(auto it: rargs)
+    if(it.find_first_of("*?[$`") != std::string::npos)
+      run->unchecked_resolves++;
+
   std::string dir;
-  if(g_cd && !opts['C'])
+  if(run->cd && !opts['C'])
   {
-    dir=_pre_cd(ctx.filename);
+    dir=_pre_cd(ctx.filename, run);
     if(ex_dir!=nullptr)
       *ex_dir=dir;
   }
@@ -86,24 +110,85 @@ std::vector<std::pair<std::string, std::string>> do_include_raw(condlist_t* cmd,
   for(auto it: rargs)
     command += it + ' ';
   command += "; do echo $I ; done";
-  std::string inc=ztd::sh(command); /* takes 1ms */
+  std::string inc=shell_run(command, current_dir(run)).first;
 
   auto v = split(inc, '\n');
 
   for(auto it: v)
   {
-    if(opts['f'] || add_include(it))
+    if(opts['f'] || add_include(it, run))
     {
-      ret.push_back(std::make_pair(it, import_file(it)));
+      ret.push_back(std::make_pair(it, import_file(include_path(it, run))));
+      run->include_deps.push_back({include_path(it, run), hash_string(ret.back().second), !opts['f']});
     }
   }
 
   if(ex_dir==nullptr)
-    _cd(dir);
+    _cd(dir, run);
 
   return ret;
 }
 
+// entry of the %resolve cache for cmd in the current directory, empty if not cached
+// declared input files and variables are part of the key
+std::string resolve_cache_path(std::string const& cmd, ztd::option_set& opts, run_context* run)
+{
+  std::string dir = get_resolve_cache_dir(opts['c'], run);
+  if(dir == "")
+    return "";
+  std::string key = cmd + '\0' + current_dir(run) + '\0';
+  for(auto it: split(opts['i'].argument, " \t\n"))
+  {
+    key += it + '\0';
+    try {
+      key += hash_string(import_file(include_path(it, run)));
+    }
+    catch(std::runtime_error& e) {
+      key += '-';
+    }
+    key += '\0';
+  }
+  key += '\0';
+  for(auto it: split(opts['E'].argument, " \t\n"))
+  {
+    const char* val = getenv(it.c_str());
+    key += it + (val != NULL ? '=' + std::string(val) : "") + '\0';
+  }
+  return dir + '/' + hash_string(key);
+}
+
+// cached output of a %resolve command in the current directory
+// cachepath is set to the entry to write to, empty if not cached
+bool resolve_cache_get(std::string const& fullcmd, ztd::option_set& opts, run_context* run, std::string* cachepath, std::string* out)
+{
+  *cachepath = resolve_cache_path(fullcmd, opts, run);
+  if(*cachepath == "" || run->options["resolve-refresh"])
+    return false;
+  uint64_t ttl=0;
+  try
+  {
+    if(opts['t'])
+      ttl = parse_ttl(opts['t'].argument);
+    else if(run->options["resolve-ttl"])
+      ttl = parse_ttl(run->options["resolve-ttl"].argument);
+  }
+  catch(std::runtime_error& e)
+  {
+    throw std::runtime_error(std::string("%resolve: ")+e.what());
+  }
+  return cache_read(*cachepath, ttl, out);
+}
+
+// command line of a %resolve, rest is the condlist without the %resolve command
+std::string resolve_command(std::vector<std::string> const& rargs, condlist_t* rest)
+{
+  std::string fullcmd=concatargs(rargs);
+  std::string othercmd=rest->generate(0);
+  if(othercmd != "")
+    fullcmd += '|' + othercmd;
+  return fullcmd;
+}
+
 //
 std::pair<std::string, std::string> do_resolve_raw(condlist_t* cmd, parse_context ctx, std::string* ex_dir)
 {
@@ -120,30 +205,43 @@ std::pair<std::string, std::string> do_resolve_raw(condlist_t* cmd, parse_contex
     throw std::runtime_error(std::string("%resolve: ")+e.what());
   }
 
+  run_context* run = ctx.run;
   std::string dir;
-  if(g_cd && !opts['C'])
+  if(run->cd && !opts['C'])
   {
-    dir=_pre_cd(ctx.filename);
+    dir=_pre_cd(ctx.filename, run);
     if(ex_dir!=nullptr)
       *ex_dir=dir;
   }
 
   cmd->prune_first_cmd();
 
-  std::string fullcmd=concatargs(rargs);
-  std::string othercmd=cmd->generate(0);
-  if(othercmd != "")
-    fullcmd += '|' + othercmd;
-
-  auto p=ztd::shp(fullcmd);
+  std::string fullcmd=resolve_command(rargs, cmd);
+  run->unchecked_resolves++;
 
-  if(!opts['f'] && p.second!=0)
+  std::pair<std::string, int> p;
+  std::string cachepath;
+  if(!resolve_cache_get(fullcmd, opts, run, &cachepath, &p.first))
   {
-    throw std::runtime_error(  strf("command `%s` returned %u", fullcmd.c_str(), p.second) );
+    auto it = run->prefetched_resolves.find(std::make_pair(current_dir(run), fullcmd));
+    if(it != run->prefetched_resolves.end() && !it->second.empty())
+    {
+      p = it->second.front();
+      it->second.pop_front();
+    }
+    else
+      p=shell_run(fullcmd, current_dir(run));
+
+    if(!opts['f'] && p.second!=0)
+    {
+      throw std::runtime_error(  strf("command `%s` returned %u", fullcmd.c_str(), p.second) );
+    }
+    if(cachepath != "" && p.second == 0)
+      cache_write(cachepath, p.first);
   }
 
   if(ex_dir==nullptr)
-    _cd(dir);
+    _cd(dir, run);
 
   while(p.first[p.first.size()-1] == '\n')
     p.first.pop_back();
@@ -152,6 +250,204 @@ std::pair<std::string, std::string> do_resolve_raw(condlist_t* cmd, parse_contex
   return ret;
 }
 
+// parsed and resolved included files, kept across runs of --watch and --daemon
+struct include_cache_entry {
+  // options the file was resolved with
+  std::string key;
+  std::string contents;
+  list_t* lst=nullptr;
+  // files read while parsing it, -f ones too
+  std::vector<include_dep> deps;
+  // added by load_include_cache(), not dumped again
+  bool loaded=false;
+};
+std::map<std::string, include_cache_entry> include_cache;
+bool g_include_cache=false;
+
+static std::string include_cache_key(bool bash, run_context* run)
+{
+  std::string ret;
+  for(auto it: { run->cd, run->include, run->resolve, bash })
+    ret += it ? '1' : '0';
+  return ret;
+}
+
+// an entry is valid if no file it read changed or was included before it
+bool include_cache_valid(include_cache_entry const& entry, std::string const& contents, bool bash, run_context* run)
+{
+  if(entry.contents != contents || entry.key != include_cache_key(bash, run))
+    return false;
+  for(auto it: entry.deps)
+  {
+    if(it.counted && std::find(run->included.begin(), run->included.end(), it.path) != run->included.end())
+      return false;
+    try {
+      if(hash_string(import_file(it.path)) != it.hash)
+        return false;
+    }
+    catch(std::runtime_error& e) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// parse and resolve an included file, in the current directory
+shmain* parse_include(std::string const& file, std::string const& contents, parse_context ctx)
+{
+  run_context* run = ctx.run;
+  std::string path = include_path(file, run);
+  if(g_include_cache)
+  {
+    auto it = include_cache.find(path);
+    if(it != include_cache.end() && include_cache_valid(it->second, contents, ctx.bash, run))
+    {
+      for(auto dep: it->second.deps)
+      {
+        if(dep.counted)
+          run->included.push_back(dep.path);
+        run->include_deps.push_back(dep);
+      }
+      shmain* sh = new shmain(it->second.lst->clone());
+      sh->filename = file;
+      return sh;
+    }
+  }
+
+  size_t n_deps = run->include_deps.size();
+  uint32_t n_unchecked = run->unchecked_resolves;
+  parse_context newctx = make_context(ctx, contents, file);
+  auto pp = parse_text(newctx);
+  shmain* sh = pp.first;
+  resolve(sh, pp.second);
+
+  if(g_include_cache)
+  {
+    auto it = include_cache.find(path);
+    if(it != include_cache.end())
+    {
+      delete it->second.lst;
+      include_cache.erase(it);
+    }
+    // %resolve and expanded paths have to run again on every build
+    if(run->unchecked_resolves == n_unchecked)
+    {
+      include_cache_entry& entry = include_cache[path];
+      entry.key = include_cache_key(ctx.bash, run);
+      entry.contents = contents;
+      entry.lst = sh->lst->clone();
+      entry.deps.assign(run->include_deps.begin()+n_deps, run->include_deps.end());
+    }
+  }
+  return sh;
+}
+
+// strings as <size>:<data>
+static void dump_string(std::string& out, std::string const& in)
+{
+  out += std::to_string(in.size()) + ':' + in;
+}
+
+static bool load_string(std::string const& in, size_t& i, std::string* out)
+{
+  size_t sep = in.find(':', i);
+  if(sep == std::string::npos || sep == i || sep-i > 19 || in.find_first_not_of("0123456789", i) != sep)
+    return false;
+  uint64_t size = std::stoull(in.substr(i, sep-i));
+  if(size > in.size()-sep-1)
+    return false;
+  *out = in.substr(sep+1, size);
+  i = sep+1+size;
+  return true;
+}
+
+// entry: path, key, contents, generated code, then path, hash and counted of each dep
+// parse the generated code of an entry, null if it has errors
+static list_t* parse_include_code(std::string const& code, std::string const& path, bool bash)
+{
+  std::vector<parse_diagnostic> errors;
+  parse_context ctx = make_context(code, path, bash);
+  ctx.errors = &errors;
+  shmain* sh;
+  try {
+    sh = parse_text(ctx).first;
+  }
+  catch(std::exception& e) {
+    return nullptr;
+  }
+  list_t* ret = errors.size() == 0 ? sh->lst : nullptr;
+  if(ret != nullptr)
+    sh->lst = nullptr;
+  delete sh;
+  return ret;
+}
+
+std::string dump_include_cache()
+{
+  std::string ret;
+  // entries are loaded by runs with other options
+  bool minify = opt_minify;
+  opt_minify = false;
+  for(auto& it: include_cache)
+  {
+    if(it.second.loaded)
+      continue;
+    // only share entries that are parsed back to the same code
+    std::string code = it.second.lst->generate(0);
+    list_t* lst = parse_include_code(code, it.first, it.second.key[3] == '1');
+    bool same = lst != nullptr && lst->generate(0) == code;
+    delete lst;
+    if(!same)
+      continue;
+    dump_string(ret, it.first);
+    dump_string(ret, it.second.key);
+    dump_string(ret, it.second.contents);
+    dump_string(ret, code);
+    dump_string(ret, std::to_string(it.second.deps.size()));
+    for(auto& dep: it.second.deps)
+    {
+      dump_string(ret, dep.path);
+      dump_string(ret, dep.hash);
+      dump_string(ret, dep.counted ? "1" : "0");
+    }
+  }
+  opt_minify = minify;
+  return ret;
+}
+
+void load_include_cache(std::string const& in)
+{
+  size_t i=0;
+  while(i < in.size())
+  {
+    include_cache_entry entry;
+    std::string path, code, n;
+    if(!load_string(in, i, &path) || !load_string(in, i, &entry.key) || !load_string(in, i, &entry.contents)
+      || !load_string(in, i, &code) || !load_string(in, i, &n) || entry.key.size() != 4
+      || n == "" || n.size() > 9 || n.find_first_not_of("0123456789") != std::string::npos)
+      return;
+    for(uint64_t j=std::stoul(n); j>0; j--)
+    {
+      include_dep dep;
+      std::string counted;
+      if(!load_string(in, i, &dep.path) || !load_string(in, i, &dep.hash) || !load_string(in, i, &counted))
+        return;
+      dep.counted = counted == "1";
+      entry.deps.push_back(dep);
+    }
+    // the code is already resolved
+    entry.lst = parse_include_code(code, path, entry.key[3] == '1');
+    if(entry.lst == nullptr)
+      continue;
+    entry.loaded = true;
+
+    auto it = include_cache.find(path);
+    if(it != include_cache.end())
+      delete it->second.lst;
+    include_cache[path] = entry;
+  }
+}
+
 std::vector<condlist_t*> do_include_parse(condlist_t* cmd, parse_context ctx)
 {
   std::vector<condlist_t*> ret;
@@ -163,13 +459,7 @@ std::vector<condlist_t*> do_include_parse(condlist_t* cmd, parse_context ctx)
   shs.resize(incs.size());
 
   for(uint32_t i=0; i<incs.size(); i++)
-  {
-    parse_context newctx = make_context(ctx, incs[i].second, incs[i].first);
-    auto pp = parse_text(newctx);
-    shmain* sh = pp.first;
-    resolve(sh, pp.second);
-    shs[i] = sh;
-  }
+    shs[i] = parse_include(incs[i].first, incs[i].second, ctx);
   for(auto sh: shs)
   {
     // get the cls
@@ -180,7 +470,7 @@ std::vector<condlist_t*> do_include_parse(condlist_t* cmd, parse_context ctx)
   }
   shs.resize(0);
   // cd back
-  _cd(dir);
+  _cd(dir, ctx.run);
 
   return ret;
 }
@@ -208,7 +498,7 @@ std::vector<condlist_t*> do_resolve_parse(condlist_t* cmd, parse_context ctx)
     sh->lst->cls.resize(0);
     delete sh;
     // cd back
-    _cd(dir);
+    _cd(dir, ctx.run);
   }
   catch(format_error& e)
   {
@@ -228,9 +518,9 @@ std::pair< std::vector<condlist_t*> , bool > resolve_condlist(condlist_t* in, pa
 
   std::string const& strcmd=tc->arg_string(0);
 
-  if(g_include && strcmd == "%include")
+  if(ctx.run->include && strcmd == "%include")
     return std::make_pair(do_include_parse(in, ctx), true);
-  else if(g_resolve && strcmd == "%resolve")
+  else if(ctx.run->resolve && strcmd == "%resolve")
     return std::make_pair(do_resolve_parse(in, ctx), true);
   else
     return std::make_pair(std::vector<condlist_t*>(), false);
@@ -260,12 +550,12 @@ std::pair< std::vector<arg_t*> , bool > resolve_arg(arg_t* in, parse_context ctx
       continue;
     std::string strcmd=c->arg_string(0);
     std::string fulltext;
-    if(g_include && strcmd == "%include")
+    if(ctx.run->include && strcmd == "%include")
     {
       for(auto it: do_include_raw(tc, ctx) )
         fulltext += it.second;
     }
-    else if(g_resolve && strcmd == "%resolve")
+    else if(ctx.run->resolve && strcmd == "%resolve")
     {
       fulltext = do_resolve_raw(tc, ctx).second;
     }
@@ -440,8 +730,100 @@ void resolve(_obj* in, parse_context* ctx)
   recurse(r_resolve, in, ctx);
 }
 
+bool r_get_resolves(_obj* o, std::vector<condlist_t*>* ret)
+{
+  if(o->type != _obj::condlist)
+    return true;
+  cmd_t* c = dynamic_cast<condlist_t*>(o)->first_cmd();
+  if(c == nullptr)
+    return true;
+  std::string const& strcmd=c->arg_string(0);
+  if(strcmd == "%resolve")
+  {
+    ret->push_back(dynamic_cast<condlist_t*>(o));
+    return false;
+  }
+  // not resolved in place
+  return strcmd != "%include";
+}
+
+// first phase of --parallel-resolve: run the %resolve commands of the tree concurrently
+// do_resolve_raw then takes their output in order
+// commands inside resolved output are run when that output is resolved
+void prefetch_resolves(_obj* in, parse_context ctx)
+{
+  struct resolve_job {
+    std::string dir;
+    std::string fullcmd;
+    std::pair<std::string,int> result;
+  };
+
+  run_context* run = ctx.run;
+  std::vector<condlist_t*> cls;
+  recurse(r_get_resolves, in, &cls);
+
+  std::vector<resolve_job> jobs;
+  for(auto cl: cls)
+  {
+    ztd::option_set opts = create_resolve_opts();
+    std::vector<std::string> rargs;
+    try
+    {
+      rargs = opts.process(cl->first_cmd()->args->strargs(1), {.stop_on_argument=true} );
+    }
+    catch(ztd::option_error& e)
+    {
+      continue; // reported when resolved
+    }
+
+    condlist_t* rest = cl->clone();
+    rest->prune_first_cmd();
+    std::string fullcmd=resolve_command(rargs, rest);
+    delete rest;
+
+    std::string dir;
+    if(run->cd && !opts['C'])
+      dir=_pre_cd(ctx.filename, run);
+    std::string cwd=current_dir(run);
+    std::string cachepath, out;
+    bool cached=false;
+    try
+    {
+      cached = resolve_cache_get(fullcmd, opts, run, &cachepath, &out);
+    }
+    catch(std::runtime_error& e)
+    {
+      cached = true; // reported when resolved
+    }
+    _cd(dir, run);
+
+    if(!cached)
+      jobs.push_back({cwd, fullcmd});
+  }
+
+  // threads share the working directory: cd in the command instead
+  parallel_for(jobs.size(), [&](uint32_t i) {
+    jobs[i].result = ztd::shp("cd -- " + single_quote(jobs[i].dir) + " || exit\n" + jobs[i].fullcmd);
+  }, run->jobs);
+
+  for(auto& it: jobs)
+    run->prefetched_resolves[std::make_pair(it.dir, it.fullcmd)].push_back(it.result);
+}
+
 // recursive call of resolve
 void resolve(_obj* in, parse_context ctx)
 {
+  // unused outputs are dropped when the top-level call ends, even on error
+  struct depth_guard {
+    run_context* run;
+    depth_guard(run_context* run) : run(run) { run->resolve_depth++; }
+    ~depth_guard() {
+      if(--run->resolve_depth == 0)
+        run->prefetched_resolves.clear();
+    }
+  } guard(ctx.run);
+
+  if(ctx.run->resolve && ctx.run->options["parallel-resolve"])
+    prefetch_resolves(in, ctx);
   recurse(r_resolve, in, &ctx);
 }
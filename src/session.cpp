@@ -0,0 +1,173 @@
+#include "session.hpp"
+
+#include "options.hpp"
+#include "parse.hpp"
+#include "resolve.hpp"
+#include "minify.hpp"
+#include "optimize.hpp"
+#include "debashify.hpp"
+#include "shellcode.hpp"
+#include "recursive.hpp"
+#include "util.hpp"
+
+void process_script(shmain* sh, bool shebang_is_bin, run_context* run, strmap_t* varmap, strmap_t* fctmap)
+{
+  ztd::option_set& options = run->options;
+  // implement commands
+  std::set<std::string> req_fcts;
+  if(shebang_is_bin && !options["no-extend"])
+    req_fcts = find_lxsh_commands(sh);
+  if(options["debashify"])
+    concat_sets(req_fcts, debashify(sh, run->jobs) );
+
+  add_lxsh_fcts(sh, req_fcts);
+
+  // optimize
+  if(options['O'])
+    optimize(sh, run);
+
+  // processing before output
+  // minify
+  if(options['m'])
+  {
+    opt_minify=true;
+    minify_generic(sh, run);
+  }
+  if(options['A']) {
+    read_minmap(options['A'].argument, varmap, fctmap);
+    recurse(r_replace_var, sh, varmap);
+    recurse(r_replace_fct, sh, fctmap);
+  }
+  else if(options["minify-var"] && options["minify-fct"]) {
+    // optimization: get everything in one go
+    allmaps_get(sh, run->re_var_exclude, run->re_fct_exclude, regex_null);
+    *varmap = minify_var( sh, run->re_var_exclude );
+    *fctmap = minify_fct( sh, run->re_fct_exclude );
+  }
+  else if(options["minify-var"]) {
+    *varmap = minify_var( sh, run->re_var_exclude );
+  }
+  else if(options["minify-fct"]) {
+    *fctmap = minify_fct( sh, run->re_fct_exclude );
+  }
+  if(options["minify-str"])
+    minify_strings(sh, run->re_var_exclude);
+  // other processing
+  if(options["unset-var"])
+    add_unset_variables( sh, run->re_var_exclude );
+}
+
+/** SESSION **/
+
+// value given back to a variable when the scope ends
+template <class T>
+class restore_guard
+{
+public:
+  restore_guard(T& ref) : ref(ref), val(ref) {}
+  ~restore_guard() { ref = val; }
+private:
+  T& ref;
+  T val;
+};
+
+// options before any session changed them
+static ztd::option_set const& default_options()
+{
+  static const ztd::option_set ret=g_ctx.options;
+  return ret;
+}
+
+lxsh_session::lxsh_session()
+{
+  run.options = default_options();
+  get_opts(&run);
+  sh = new shmain;
+}
+
+lxsh_session::~lxsh_session()
+{
+  delete sh;
+}
+
+void lxsh_session::set_options(std::vector<std::string> const& args)
+{
+  // check values before changing the session
+  run_context t;
+  t.options = default_options();
+  t.options.process(args);
+  get_opts(&t);
+  run.options = t.options;
+  get_opts(&run);
+}
+
+void lxsh_session::parse(std::string const& code, std::string const& filename)
+{
+  if(filename != "" && !add_include(filename, &run))
+    return;
+
+  // errors are thrown to the caller instead of printed
+  std::vector<parse_diagnostic> errors;
+  parse_context ctx = make_context(code, filename, run.options["bash"] || run.options["debashify"]);
+  ctx.errors = &errors;
+  ctx.run = &run;
+  auto pp = parse_text(ctx);
+  shmain* tsh = pp.first;
+  try
+  {
+    if(errors.size() > 0)
+      throw format_error(errors[0].message, filename, code, errors[0].i);
+    if(run.options["bash"])
+      tsh->shebang = "#!/usr/bin/env bash";
+    else if(run.options["lxsh"])
+      tsh->shebang = "#!/bin/sh";
+    if(run.include || run.resolve)
+      resolve(tsh, pp.second);
+  }
+  catch(...)
+  {
+    delete tsh;
+    throw;
+  }
+  sh->concat(tsh);
+  delete tsh;
+}
+
+void lxsh_session::parse_file(std::string const& filename)
+{
+  parse(import_file(filename), filename);
+}
+
+void lxsh_session::process()
+{
+  // object maps and opt_minify are per thread: start from a clean state
+  require_rescan_all();
+  restore_guard<bool> minify(opt_minify);
+  opt_minify = false;
+  // --lxsh implies --debashify, for this call only
+  restore_guard<bool> debashify(run.options["debashify"].activated);
+  if(run.options["lxsh"])
+    run.options["debashify"].activated=true;
+  if(run.options["remove-unused"])
+    delete_unused( sh, run.re_var_exclude, run.re_fct_exclude );
+  varmap.clear();
+  fctmap.clear();
+  process_script(sh, run.options["lxsh"], &run, &varmap, &fctmap);
+}
+
+std::string lxsh_session::generate()
+{
+  restore_guard<bool> minify(opt_minify);
+  opt_minify = run.options['m'];
+  return sh->generate(run.shebang, 0);
+}
+
+void lxsh_session::clear()
+{
+  delete sh;
+  sh = new shmain;
+  run.included.clear();
+  run.include_deps.clear();
+  varmap.clear();
+  fctmap.clear();
+}
@@ -1,5 +1,7 @@
 #include "shellcode.hpp"
 
+#include <mutex>
+
 #include "g_shellcode.h"
 #include "processing.hpp"
 #include "struc_helper.hpp"
@@ -7,8 +9,8 @@
 const std::map<const std::string, const lxsh_fct> lxsh_extend_fcts = {
     { "_lxsh_random",         { "[K]", "Generate a random number between 0 and 2^(K*8). Default 2", RANDOM_SH} },
     { "_lxsh_random_string",  { "[N]", "Generate a random alphanumeric string of length N. Default 20", RANDOM_STRING_SH} },
-    { "_lxsh_random_tmpfile", { "[PREFIX] [N]", "Get a random TMP filepath, with N random chars. Default 20", RANDOM_TMPFILE_SH, {"_lxsh_random_string"} }
-  }
+    { "_lxsh_random_tmpfile", { "[PREFIX] [N]", "Get a random TMP filepath, with N random chars. Default 20", RANDOM_TMPFILE_SH, {"_lxsh_random_string"} } },
+    { "_lxsh_substring",      { "<STR> <OFFSET> [LENGTH]", "Get substring of STR, with bash ${VAR:OFFSET:LENGTH} semantics", SUBSTRING_SH} }
 };
 
 const std::map<const std::string, const lxsh_fct> lxsh_array_fcts = {
@@ -30,9 +32,8 @@ std::map<const std::string, const lxsh_fct> create_allfcts()
 
 const std::map<const std::string, const lxsh_fct> lxsh_allfcts = create_allfcts();
 
-void add_lxsh_fcts(shmain* sh, std::set<std::string> fcts)
+std::set<std::string> lxsh_fcts_depends(std::set<std::string> fcts)
 {
-  // resolve dependencies
   for(auto fctname: fcts)
   {
     auto ti=lxsh_allfcts.find(fctname);
@@ -40,6 +41,46 @@ void add_lxsh_fcts(shmain* sh, std::set<std::string> fcts)
       for(auto dep: ti->second.depends_on)
         fcts.insert(dep);
   }
+  return fcts;
+}
+
+std::string lxsh_fcts_code(std::set<std::string> const& fcts)
+{
+  static std::map<std::set<std::string>, std::string> cache;
+  static std::mutex cache_mutex;
+
+  std::lock_guard<std::mutex> lock(cache_mutex);
+  auto it=cache.find(fcts);
+  if(it != cache.end())
+    return it->second;
+
+  std::string ret;
+  for(auto fctname: fcts)
+  {
+    auto ti=lxsh_allfcts.find(fctname);
+    if(ti != lxsh_allfcts.end())
+      ret += ti->second.code;
+  }
+  cache.insert(std::make_pair(fcts, ret));
+  return ret;
+}
+
+// find calls to lxsh functions
+bool r_get_lxsh_cmds(_obj* in, std::set<std::string>* fcts)
+{
+  if(in->type == _obj::block_cmd)
+  {
+    cmd_t* t = dynamic_cast<cmd_t*>(in);
+    std::string const& cmdstr=t->arg_string(0);
+    if(cmdstr.substr(0,6) == "_lxsh_" && lxsh_allfcts.find(cmdstr) != lxsh_allfcts.end())
+      fcts->insert(cmdstr);
+  }
+  return true;
+}
+
+void add_lxsh_fcts(shmain* sh, std::set<std::string> fcts)
+{
+  fcts = lxsh_fcts_depends(fcts);
   // insert functions
   for(auto it: fcts)
   {
@@ -2,14 +2,164 @@
 
 #include "parse.hpp"
 #include "options.hpp"
+#include "recursive.hpp"
+#include "util.hpp"
+
+#include <map>
+#include <mutex>
 
 // ** FUNCTIONS ** //
 
+// templates
+
+// parse each distinct template once and hand out copies of the result
+// one cache per object type, for the life of the process: only give it constant strings
+template<class T>
+T* instantiate(std::string const& in, T* (*parser)(std::string const&))
+{
+  static std::map<std::string,T*> cache;
+  static std::mutex cache_mutex;
+
+  std::lock_guard<std::mutex> lock(cache_mutex);
+  auto it = cache.find(in);
+  if(it == cache.end())
+    it = cache.insert(std::make_pair(in, parser(in))).first;
+  return copy(it->second);
+}
+
+cmd_t* parse_cmd_template(std::string const& in) {
+  return parse_cmd(make_context(in)).first;
+}
+pipeline_t* parse_pipeline_template(std::string const& in) {
+  return parse_pipeline(make_context(in)).first;
+}
+condlist_t* parse_condlist_template(std::string const& in) {
+  return parse_condlist(make_context(in)).first;
+}
+list_t* parse_list_template(std::string const& in) {
+  return std::get<0>(parse_list_until(make_context(in)));
+}
+block_t* parse_block_template(std::string const& in) {
+  return parse_block(make_context(in)).first;
+}
+arg_t* parse_arg_template(std::string const& in) {
+  return parse_arg(make_context(in)).first;
+}
+
+// slots of a template instance
+struct template_slots {
+  std::vector<std::pair<uint32_t,arg_t**>> args;
+  std::vector<std::pair<uint32_t,block_t**>> blocks;
+};
+
+// N if arg is @N, 0 otherwise
+uint32_t slot_index(arg_t* in)
+{
+  if(in == nullptr || !in->is_string())
+    return 0;
+  std::string const& str = dynamic_cast<subarg_string_t*>(in->sa[0])->val;
+  if(str.size() < 2 || str[0] != '@' || str.find_first_not_of("0123456789", 1) != std::string::npos)
+    return 0;
+  return std::stoi(str.substr(1));
+}
+
+bool r_get_slots(_obj* o, template_slots* slots)
+{
+  switch(o->type)
+  {
+    case _obj::arglist: {
+      arglist_t* t = dynamic_cast<arglist_t*>(o);
+      for(auto& it: t->args)
+        if(uint32_t n=slot_index(it))
+          slots->args.push_back(std::make_pair(n, &it));
+    } break;
+    case _obj::redirect: {
+      redirect_t* t = dynamic_cast<redirect_t*>(o);
+      if(uint32_t n=slot_index(t->target))
+        slots->args.push_back(std::make_pair(n, &t->target));
+    } break;
+    case _obj::block_cmd: {
+      cmd_t* t = dynamic_cast<cmd_t*>(o);
+      for(auto& it: t->var_assigns)
+        if(uint32_t n=slot_index(it.second))
+          slots->args.push_back(std::make_pair(n, &it.second));
+    } break;
+    case _obj::pipeline: {
+      pipeline_t* t = dynamic_cast<pipeline_t*>(o);
+      for(auto& it: t->cmds)
+      {
+        cmd_t* c = dynamic_cast<cmd_t*>(it);
+        if(c != nullptr && c->var_assigns.size() == 0 && c->arglist_size() == 1)
+          if(uint32_t n=slot_index(c->args->args[0]))
+            slots->blocks.push_back(std::make_pair(n, &it));
+      }
+    } break;
+    case _obj::block_case: {
+      case_t* t = dynamic_cast<case_t*>(o);
+      if(uint32_t n=slot_index(t->carg))
+        slots->args.push_back(std::make_pair(n, &t->carg));
+    } break;
+    default: break;
+  }
+  return true;
+}
+
+template<class T>
+T* fill_slots(T* in, std::vector<_obj*> const& values)
+{
+  template_slots slots;
+  recurse(r_get_slots, in, &slots);
+
+  auto check = [&](uint32_t n) {
+    if(n > values.size() || values[n-1] == nullptr)
+      throw std::runtime_error(strf("Template slot @%u has no value", n));
+  };
+  for(auto it: slots.args)
+    check(it.first);
+  for(auto it: slots.blocks)
+    check(it.first);
+
+  std::vector<bool> used(values.size(), false);
+  auto get_value = [&](uint32_t n) -> _obj* {
+    _obj* ret = values[n-1];
+    if(used[n-1])
+      ret = ret->clone();
+    used[n-1] = true;
+    return ret;
+  };
+
+  for(auto it: slots.blocks)
+  {
+    if(dynamic_cast<block_t*>(values[it.first-1]) == nullptr)
+      continue;
+    block_t* val = dynamic_cast<block_t*>(get_value(it.first));
+    // keep redirects of the placeholder
+    val->redirs.insert(val->redirs.end(), (*it.second)->redirs.begin(), (*it.second)->redirs.end());
+    (*it.second)->redirs.resize(0);
+    delete *it.second;
+    *it.second = val;
+  }
+  for(auto it: slots.args)
+  {
+    if(dynamic_cast<arg_t*>(values[it.first-1]) == nullptr)
+      continue;
+    delete *it.second;
+    *it.second = dynamic_cast<arg_t*>(get_value(it.first));
+  }
+
+  // unused values are discarded
+  for(uint32_t i=0; i<values.size(); i++)
+    if(!used[i])
+      delete values[i];
+
+  return in;
+}
+
 // makers
 
 arg_t* make_arg(std::string const& in)
 {
-  return parse_arg(make_context(in)).first;
+  return instantiate(in, parse_arg_template);
 }
 
 cmd_t* make_cmd(std::vector<const char*> const& args)
@@ -42,7 +192,7 @@ cmd_t* make_cmd(std::vector<arg_t*> const& args)
 
 cmd_t* make_cmd(std::string const& in)
 {
-  return parse_cmd(make_context(in)).first;
+  return instantiate(in, parse_cmd_template);
 }
 
 pipeline_t* make_pipeline(std::vector<block_t*> const& bls)
@@ -56,23 +206,49 @@ pipeline_t* make_pipeline(std::vector<block_t*> const& bls)
 
 pipeline_t* make_pipeline(std::string const& in)
 {
-  return parse_pipeline(make_context(in)).first;
+  return instantiate(in, parse_pipeline_template);
 }
 
 condlist_t* make_condlist(std::string const& in)
 {
-  return parse_condlist(make_context(in)).first;
+  return instantiate(in, parse_condlist_template);
 }
 
 list_t* make_list(std::string const& in)
 {
-  auto t = parse_list_until(make_context(in));
-  return std::get<0>(t);
+  return instantiate(in, parse_list_template);
 }
 
 block_t* make_block(std::string const& in)
 {
-  return parse_block(make_context(in)).first;
+  return instantiate(in, parse_block_template);
+}
+
+cmd_t* make_cmd(std::string const& in, std::vector<_obj*> const& slots)
+{
+  return fill_slots(make_cmd(in), slots);
+}
+
+condlist_t* make_condlist(std::string const& in, std::vector<_obj*> const& slots)
+{
+  return fill_slots(make_condlist(in), slots);
+}
+
+list_t* make_list(std::string const& in, std::vector<_obj*> const& slots)
+{
+  return fill_slots(make_list(in), slots);
+}
+
+block_t* make_block(std::string const& in, std::vector<_obj*> const& slots)
+{
+  return fill_slots(make_block(in), slots);
+}
+
+arg_t* make_quoted_var(std::string const& name)
+{
+  arg_t* ret = new arg_t(new subarg_variable_t(new variable_t(name)));
+  force_quotes(ret);
+  return ret;
 }
 
 cmd_t* make_printf(arg_t* in)
@@ -123,13 +299,6 @@ arithmetic_t* make_arithmetic(arg_t* arg1, std::string op, arg_t* arg2)
 }
 
 
-// copy
-
-arg_t* copy(arg_t* in) {
-  std::string str = in->generate(0);
-  return parse_arg(make_context(str)).first;
-}
-
 // modifiers
 
 void force_quotes(arg_t* in)
@@ -327,6 +496,221 @@ cmd_t* block_t::single_cmd()
   return nullptr;
 }
 
+/// CLONE ///
+
+// copy constructors make shallow copies: replace all owned objects with copies
+
+arg_t* arg_t::clone()
+{
+  arg_t* ret = new arg_t(*this);
+  for(auto& it: ret->sa)
+    it = copy(it);
+  return ret;
+}
+
+variable_t* variable_t::clone()
+{
+  variable_t* ret = new variable_t(*this);
+  ret->index = copy(index);
+  ret->manip = copy(manip);
+  return ret;
+}
+
+arglist_t* arglist_t::clone()
+{
+  arglist_t* ret = new arglist_t(*this);
+  for(auto& it: ret->args)
+    it = copy(it);
+  return ret;
+}
+
+redirect_t* redirect_t::clone()
+{
+  redirect_t* ret = new redirect_t(*this);
+  ret->target = copy(target);
+  ret->here_document = copy(here_document);
+  return ret;
+}
+
+pipeline_t* pipeline_t::clone()
+{
+  pipeline_t* ret = new pipeline_t(*this);
+  for(auto& it: ret->cmds)
+    it = copy(it);
+  return ret;
+}
+
+condlist_t* condlist_t::clone()
+{
+  condlist_t* ret = new condlist_t(*this);
+  for(auto& it: ret->pls)
+    it = copy(it);
+  return ret;
+}
+
+list_t* list_t::clone()
+{
+  list_t* ret = new list_t(*this);
+  for(auto& it: ret->cls)
+    it = copy(it);
+  return ret;
+}
+
+// block_t redirects
+template<class T>
+T* clone_block(T* in)
+{
+  T* ret = new T(*in);
+  for(auto& it: ret->redirs)
+    it = copy(it);
+  return ret;
+}
+
+cmd_t* cmd_t::clone()
+{
+  cmd_t* ret = clone_block(this);
+  ret->args = copy(args);
+  for(auto& it: ret->var_assigns)
+    it = std::make_pair(copy(it.first), copy(it.second));
+  for(auto& it: ret->cmd_var_assigns)
+    it = std::make_pair(copy(it.first), copy(it.second));
+  return ret;
+}
+
+shmain* shmain::clone()
+{
+  shmain* ret = clone_block(this);
+  ret->lst = copy(lst);
+  return ret;
+}
+
+subshell_t* subshell_t::clone()
+{
+  subshell_t* ret = clone_block(this);
+  ret->lst = copy(lst);
+  return ret;
+}
+
+brace_t* brace_t::clone()
+{
+  brace_t* ret = clone_block(this);
+  ret->lst = copy(lst);
+  return ret;
+}
+
+function_t* function_t::clone()
+{
+  function_t* ret = clone_block(this);
+  ret->lst = copy(lst);
+  return ret;
+}
+
+case_t* case_t::clone()
+{
+  case_t* ret = clone_block(this);
+  ret->carg = copy(carg);
+  for(auto& cit: ret->cases)
+  {
+    for(auto& ait: cit.first)
+      ait = copy(ait);
+    cit.second = copy(cit.second);
+  }
+  return ret;
+}
+
+if_t* if_t::clone()
+{
+  if_t* ret = clone_block(this);
+  for(auto& it: ret->blocks)
+    it = std::make_pair(copy(it.first), copy(it.second));
+  ret->else_lst = copy(else_lst);
+  return ret;
+}
+
+for_t* for_t::clone()
+{
+  for_t* ret = clone_block(this);
+  ret->var = copy(var);
+  ret->iter = copy(iter);
+  ret->ops = copy(ops);
+  return ret;
+}
+
+while_t* while_t::clone()
+{
+  while_t* ret = clone_block(this);
+  ret->cond = copy(cond);
+  ret->ops = copy(ops);
+  return ret;
+}
+
+subarg_string_t* subarg_string_t::clone()
+{
+  return new subarg_string_t(*this);
+}
+
+subarg_variable_t* subarg_variable_t::clone()
+{
+  subarg_variable_t* ret = new subarg_variable_t(*this);
+  ret->var = copy(var);
+  return ret;
+}
+
+subarg_arithmetic_t* subarg_arithmetic_t::clone()
+{
+  subarg_arithmetic_t* ret = new subarg_arithmetic_t(*this);
+  ret->arith = copy(arith);
+  return ret;
+}
+
+subarg_subshell_t* subarg_subshell_t::clone()
+{
+  subarg_subshell_t* ret = new subarg_subshell_t(*this);
+  ret->sbsh = copy(sbsh);
+  return ret;
+}
+
+subarg_procsub_t* subarg_procsub_t::clone()
+{
+  subarg_procsub_t* ret = new subarg_procsub_t(*this);
+  ret->sbsh = copy(sbsh);
+  return ret;
+}
+
+arithmetic_operation_t* arithmetic_operation_t::clone()
+{
+  arithmetic_operation_t* ret = new arithmetic_operation_t(*this);
+  ret->val1 = copy(val1);
+  ret->val2 = copy(val2);
+  return ret;
+}
+
+arithmetic_subshell_t* arithmetic_subshell_t::clone()
+{
+  arithmetic_subshell_t* ret = new arithmetic_subshell_t(*this);
+  ret->sbsh = copy(sbsh);
+  return ret;
+}
+
+arithmetic_parenthesis_t* arithmetic_parenthesis_t::clone()
+{
+  arithmetic_parenthesis_t* ret = new arithmetic_parenthesis_t(*this);
+  ret->val = copy(val);
+  return ret;
+}
+
+arithmetic_number_t* arithmetic_number_t::clone()
+{
+  return new arithmetic_number_t(*this);
+}
+
+arithmetic_variable_t* arithmetic_variable_t::clone()
+{
+  arithmetic_variable_t* ret = new arithmetic_variable_t(*this);
+  ret->var = copy(var);
+  return ret;
+}
+
 /// MODIFIERS ///
 
 // simple setters
@@ -5,6 +5,9 @@
 #include <sys/wait.h>
 
 #include <tuple>
+#include <thread>
+#include <atomic>
+#include <mutex>
 
 #include <iostream>
 #include <fstream>
@@ -101,6 +104,19 @@ std::string escape_str(std::string const& in)
   return ret;
 }
 
+std::string single_quote(std::string const& in)
+{
+  std::string ret = "'";
+  for(auto c: in)
+  {
+    if(c == '\'')
+      ret += "'\\''";
+    else
+      ret += c;
+  }
+  return ret + '\'';
+}
+
 std::string delete_brackets(std::string const& in)
 {
   std::string ret;
@@ -260,3 +276,63 @@ void printFormatError(format_error const& e, bool print_line)
     std::cerr << repeatString(" ", index-j) << '^' << std::endl;
   }
 }
+
+bool write_all(int fd, const char* data, size_t len)
+{
+  while(len > 0)
+  {
+    ssize_t r = write(fd, data, len);
+    if(r < 0)
+    {
+      if(errno == EINTR)
+        continue;
+      return false;
+    }
+    data += r;
+    len -= r;
+  }
+  return true;
+}
+
+void parallel_for(uint32_t n, std::function<void(uint32_t)> const& fct, uint32_t jobs)
+{
+  if(jobs == 0)
+    jobs = std::thread::hardware_concurrency();
+  if(jobs > n)
+    jobs = n;
+  if(jobs <= 1)
+  {
+    for(uint32_t i=0; i<n; i++)
+      fct(i);
+    return;
+  }
+
+  std::atomic<uint32_t> next(0);
+  std::exception_ptr error=nullptr;
+  std::mutex error_mutex;
+  auto worker = [&]() {
+    uint32_t i;
+    while( (i=next++) < n )
+    {
+      try {
+        fct(i);
+      }
+      catch(...) {
+        std::lock_guard<std::mutex> lock(error_mutex);
+        if(error == nullptr)
+          error = std::current_exception();
+        next = n;
+      }
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for(uint32_t i=1; i<jobs; i++)
+    threads.push_back(std::thread(worker));
+  worker();
+  for(auto& it: threads)
+    it.join();
+
+  if(error != nullptr)
+    std::rethrow_exception(error);
+}
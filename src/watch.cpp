@@ -0,0 +1,89 @@
+#include "watch.hpp"
+
+#include <map>
+#include <set>
+#include <chrono>
+#include <stdexcept>
+
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/inotify.h>
+
+#include "util.hpp"
+
+// events of a file being replaced or written to, editors often save through a rename
+#define WATCH_EVENTS (IN_CLOSE_WRITE|IN_MOVED_TO|IN_CREATE|IN_DELETE)
+// changes closer than this are one rebuild
+#define WATCH_DEBOUNCE_MS 50
+
+// read pending events, return true if one is on a watched file
+static bool read_events(int fd, std::map<int, std::set<std::string>> const& watched)
+{
+  alignas(struct inotify_event) char buf[4096];
+  bool ret=false;
+  ssize_t len = read(fd, buf, sizeof(buf));
+  if(len < 0)
+  {
+    if(errno == EINTR || errno == EAGAIN)
+      return false;
+    throw std::runtime_error("Cannot read inotify events");
+  }
+  for(char* p = buf; p < buf + len; p += sizeof(struct inotify_event) + ((struct inotify_event*) p)->len)
+  {
+    struct inotify_event* ev = (struct inotify_event*) p;
+    auto it = watched.find(ev->wd);
+    if(ev->len > 0 && it != watched.end() && it->second.count(ev->name) > 0)
+      ret=true;
+  }
+  return ret;
+}
+
+int run_watch(std::function<int()> const& build, std::function<std::vector<std::string>()> const& get_files)
+{
+  int fd = inotify_init1(IN_CLOEXEC|IN_NONBLOCK);
+  if(fd < 0)
+    throw std::runtime_error("Cannot initialize inotify");
+
+  std::map<int, std::set<std::string>> watched;
+  while(true)
+  {
+    auto start = std::chrono::steady_clock::now();
+    int ret = build();
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    fprintf(stderr, "lxsh: %s in %.1fms\n", ret == 0 ? "built" : "build failed", ms);
+
+    // watch the directories of the files
+    for(auto it: watched)
+      inotify_rm_watch(fd, it.first);
+    watched.clear();
+    for(auto it: get_files())
+    {
+      if(it == "" || is_dev_file(it))
+        continue;
+      int wd = inotify_add_watch(fd, dirname(it).c_str(), WATCH_EVENTS);
+      if(wd < 0)
+        fprintf(stderr, "lxsh: cannot watch '%s'\n", it.c_str());
+      else
+        watched[wd].insert(basename(it));
+    }
+    if(watched.size() == 0)
+    {
+      close(fd);
+      throw std::runtime_error("No file to watch");
+    }
+
+    // wait for a change, then for the writes to settle
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    bool changed=false;
+    while(!changed)
+    {
+      if(poll(&pfd, 1, -1) < 0 && errno != EINTR)
+        throw std::runtime_error("poll() failed");
+      changed = read_events(fd, watched);
+    }
+    while(poll(&pfd, 1, WATCH_DEBOUNCE_MS) > 0)
+      read_events(fd, watched);
+  }
+}
@@ -38,6 +38,8 @@ N=1
 TOTO=tatitu
 echo "${TOTO:2}"
 echo "${TOTO:$N:2}"
+echo "${TOTO: -2}" "${TOTO:0:3}" "${TOTO:1:-1}" "${TOTO:10}"
+echo "[${TOTO:N+1}]" "$N ${TOTO:1:N}"
 
 echo ${TOTO:-tutu}
 echo ${TITI:-bar}
@@ -46,3 +46,22 @@ EOF
 toto
 tata
 EOF
+
+cat << 'EOF'
+raw $toto `echo cmd`
+EOF
+
+cat << "EOF"
+$toto
+EOF
+
+cat << \EOF
+`
+$toto
+EOF
+
+cat << EOF
+$(echo sub
+) `echo cmd
+`
+EOF
@@ -0,0 +1,41 @@
+#!/bin/sh
+
+l_sum() {
+  local total i
+  total=0
+  for i in "$@" ; do
+    total=$((total + i))
+  done
+  echo "$total"
+}
+
+l_join() {
+  local sep=$1 result=""
+  shift
+  for word in "$@" ; do
+    result="$result${result:+$sep}$word"
+  done
+  echo "$result"
+}
+
+l_inner() {
+  echo "inner sees $outer_var"
+}
+
+l_outer() {
+  local outer_var=visible
+  l_inner
+}
+
+l_shadow() {
+  local value="$value local"
+  echo "$value"
+}
+
+value=global
+l_sum 1 2 3 4
+l_join , a b c
+echo "$word"
+l_outer
+l_shadow
+echo "$value"
@@ -0,0 +1,86 @@
+#!/bin/sh
+
+f() { A=f; }
+
+A=a
+(echo "$A" ; echo b) > /dev/null
+(A=b)
+(f)
+(: $((A=c)))
+(: ${A:=d})
+(read A) < /dev/null
+(set -- x y) ; echo "$#"
+(exit 2) ; echo "$? $A"
+(cd / ; pwd)
+pwd | grep -q /
+(umask 000) ; umask
+(trap 'echo trap' EXIT)
+for I in 1 2 ; do (break) ; echo "$I" ; done
+(sleep 0 &) ; echo "$!"
+( (A=e) ; echo "$A" ) 2>&1
+( echo "$A" ; echo b ) | (grep a ; echo c)
+
+for X in a/b / "" a/b// // a /a a/b/c/ "a b/c d" ; do
+  B=$(basename "$X")
+  D=$(dirname "$X")
+  echo "$X: $B $D"
+done
+echo "$(basename a/b/c) $(dirname a/b/c) $(dirname /a) $(basename /)"
+
+X="a
+b
+
+"
+echo "[$(printf %s "$X")]" "[$(printf '%s' "$X")]"
+Y="$(printf %s "$X")"
+echo "$Y"
+
+N=3
+echo "$(expr $N + 2) $(expr "$N" \* 4) $(expr 7 / $N) $(expr 7 % "$N") $(expr 1 - 1)"
+N=$(expr $N - 3) ; echo "$? $N"
+M=08
+echo "$(expr 010 + 1) $(expr $M + 1) $(expr 7 / 2) $(expr -7 % 2)"
+( echo "$(expr 7 % 0)" ) 2>/dev/null ; echo "$?"
+echo "$(echo a b) $(echo)" `echo c`
+X=$(echo a b) ; echo "$X"
+case $(echo foo bar) in "foo bar") echo case ;; esac
+echo $(echo a b) $(echo) x$(echo c)y $(basename a/b)
+
+F=${TMPDIR:-/tmp}/lxsh_optimize_$$
+printf 'a\nb\na b\n' > "$F"
+cat "$F" | grep -c a
+cat "$F" | sort | uniq
+cat /dev/null | wc -l
+echo a b | tr ' ' -
+echo | wc -c
+printf '%s\n' "$X" | wc -l
+printf '%s\n' "$F" | wc -c && echo ok
+echo x | read A ; echo "$A"
+cat "$F" | while read A ; do B=$A ; done ; echo "$B"
+echo "$(cat "$F" | grep a | wc -l) $(cat "$F" | grep -x -F 'a b' | wc -l) $(cat "$F" | grep z | wc -l)"
+N=$(cat "$F" | grep z | wc -l) ; echo "$? $N"
+echo "$(grep a "$F" | wc -l) $(grep a "$F.missing" 2>/dev/null | wc -l)"
+grep -v a "$F" | wc -l && echo ok
+grep -i -F c "$F" | wc -l && echo ok
+cat "$F" | grep -x a | wc -l
+rm -f "$F"
+
+a=3 b=4
+echo $((60*60*24)) $(( (a) )) $((a - b + 1)) $((a - (b+1))) $((2+3*4)) $(( (2+3)*4 ))
+echo $((a*1+0)) $((0-5)) $((a - -5)) $((a - (0-5))) $(( - - a )) $(( - (a+b) )) $(( ! 0 )) $(( ~0 ))
+echo $((010 + 1)) $((7/2)) $((-7/2)) $((-7%2)) $((1<<4)) $(( 0 * (a = 7) )) $a
+echo $(( ${a} * 2 * 3 )) $(( 2 * 3 * $a )) $(( ${a} + (1+2) )) $(( (c=5) + 1 )) $c $(( a += 2 * 3 ))
+echo $(( a == 9 && b != 3 || 0 )) $(( 1 ^ 3 | 4 & 5 )) $(( 3 - 2 - 1 )) $(( 8 / 4 / 2 )) $(( - 3 * 2 + 1 ))
+
+greet() { echo "hello $1" ; }
+die() { echo "error: $1" ; return 3 ; }
+twice() { printf '%s %s\n' "$1" "$1" ; }
+setv() { V=$1 ; }
+pre() { echo "${1%.*}" ; }
+greet world
+greet "$A" > /dev/null
+for I in 1 2 3 ; do twice "$I" ; done
+twice x | tr x y
+setv val ; echo "$V"
+P=a.b.c ; pre "$P"
+die oops || echo "$?"
@@ -0,0 +1,11 @@
+#!/bin/sh
+
+echo "hello world message" > /dev/null
+echo "hello world message" "it's a long one"
+echo hello\ world\ message "it's a long one" /usr/share/some/long/path
+for f in /usr/share/some/long/path "x*y  z" ; do echo "$f" ; done
+printf '%s\n' /usr/share/some/long/path "x*y  z" "it's a long one"
+[ -n "hello world message" ] && echo /usr/share/some/long/path
+case /usr/share/some/long/path in
+  /usr/*) echo "x*y  z" ;;
+esac